@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ */
+#include <gpt_config.h>
+
+#define ARENA_ALIGN     16
+
+static __thread gpt_arena_t    *_gpt_arena_current = NULL;
+static pthread_once_t           _gpt_arena_once = PTHREAD_ONCE_INIT;
+
+gpt_arena_t *
+gpt_arena_create(size_t chunk) {
+    gpt_arena_t *a;
+
+    if ((a = (gpt_arena_t *)calloc(1, sizeof(*a))) == NULL)
+        return NULL;
+    a->chunk = chunk ? chunk : GPT_ARENA_CHUNK;
+    return a;
+}
+
+static void
+_gpt_arena_release(struct arena_chunk *c) {
+    struct arena_chunk *next;
+
+    for (; c != NULL; c = next) {
+        next = c->next;
+        free(c);
+    }
+}
+
+void
+gpt_arena_destroy(gpt_arena_t *a) {
+    if (a == NULL)
+        return;
+    if (_gpt_arena_current == a)
+        _gpt_arena_current = NULL;
+    _gpt_arena_release(a->head);
+    free(a);
+}
+
+/*
+ * Offset of the next ARENA_ALIGN aligned byte in c, the chunk header
+ * does not leave data aligned to more than a pointer
+ */
+static size_t
+_gpt_arena_start(const struct arena_chunk *c) {
+    uintptr_t p = (uintptr_t)(c->data + c->used);
+
+    return ((p + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1)) - (uintptr_t)c->data;
+}
+
+void *
+gpt_arena_alloc(gpt_arena_t *a, size_t n) {
+    struct arena_chunk *c = a->head;
+    size_t              size, off = 0;
+
+    if (c == NULL || (off = _gpt_arena_start(c)) > c->size || c->size - off < n) {
+        /* chunks grow so a long session ends up with one big chunk */
+        size = c ? c->size * 2 : a->chunk;
+        while (size < n + ARENA_ALIGN)
+            size *= 2;
+        if ((c = (struct arena_chunk *)malloc(sizeof(*c) + size)) == NULL)
+            return NULL;
+        c->size = size;
+        c->used = 0;
+        c->next = a->head;
+        a->head = c;
+        off = _gpt_arena_start(c);
+    }
+    c->used = off + n;
+    return c->data + off;
+}
+
+char *
+gpt_arena_strdup(gpt_arena_t *a, const char *s) {
+    size_t  len = strlen(s) + 1;
+    char   *p;
+
+    if ((p = (char *)gpt_arena_alloc(a, len)) != NULL)
+        memcpy(p, s, len);
+    return p;
+}
+
+void
+gpt_arena_reset(gpt_arena_t *a) {
+    if (a->head == NULL)
+        return;
+    _gpt_arena_release(a->head->next);
+    a->head->next = NULL;
+    a->head->used = 0;
+}
+
+static int
+_gpt_arena_owns(const gpt_arena_t *a, const void *p) {
+    const struct arena_chunk *c;
+
+    for (c = a->head; c != NULL; c = c->next) {
+        if ((const char *)p >= c->data && (const char *)p < c->data + c->size)
+            return 1;
+    }
+    return 0;
+}
+
+static void *
+_gpt_arena_malloc(size_t n) {
+    if (_gpt_arena_current != NULL)
+        return gpt_arena_alloc(_gpt_arena_current, n);
+    return malloc(n);
+}
+
+/*
+ * Arena memory goes away with the reset, only malloc'd memory is freed
+ */
+static void
+_gpt_arena_free(void *p) {
+    if (_gpt_arena_current != NULL && _gpt_arena_owns(_gpt_arena_current, p))
+        return;
+    free(p);
+}
+
+static void
+_gpt_arena_install(void) {
+    cJSON_Hooks hooks = { _gpt_arena_malloc, _gpt_arena_free };
+
+    cJSON_InitHooks(&hooks);
+}
+
+void
+gpt_arena_hooks(gpt_arena_t *a) {
+    pthread_once(&_gpt_arena_once, _gpt_arena_install);
+    _gpt_arena_current = a;
+}
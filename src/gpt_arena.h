@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ * Bump allocator for the short lived allocations of one request,
+ * everything is released at once by gpt_arena_reset.
+ */
+#ifndef __GPT_ARENA__
+#define __GPT_ARENA__
+
+#include <gpt_config.h>
+
+#define GPT_ARENA_CHUNK     (64 * 1024)
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t              size;
+    size_t              used;
+    char                data[];
+};
+
+struct arena {
+    struct arena_chunk *head;       /* current chunk, the largest one */
+    size_t              chunk;      /* minimum chunk size */
+};
+
+gpt_arena_t *gpt_arena_create(size_t chunk);
+void gpt_arena_destroy(gpt_arena_t *a);
+/*
+ * Memory is aligned for any type and stays valid until the next reset
+ */
+void *gpt_arena_alloc(gpt_arena_t *a, size_t n);
+char *gpt_arena_strdup(gpt_arena_t *a, const char *s);
+/*
+ * Drop every allocation, the largest chunk is kept for the next request
+ */
+void gpt_arena_reset(gpt_arena_t *a);
+/*
+ * Route cJSON allocations of the calling thread to a, NULL goes back
+ * to malloc. cJSON memory taken from an arena must be freed (if at
+ * all) while that arena is still the current one.
+ */
+void gpt_arena_hooks(gpt_arena_t *a);
+
+#endif
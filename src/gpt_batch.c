@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ */
+#include <gpt_config.h>
+
+/*
+ * One prompt taken from the input, alive while its request runs
+ */
+struct batch_job {
+    gpt_batch_t *batch;
+    long         seq;
+    long         lineno;
+    char        *id;        /* JSON text of the id */
+    char        *system;
+    char        *prompt;
+    gpt_buf_t    req;
+    long         tokens;    /* estimate the rate limit admitted */
+    const char  *error;     /* the line could not be taken, nothing is sent */
+    gpt_wait_t   wait;
+};
+
+static void _gpt_batch_fill(gpt_batch_t *b);
+
+int
+gpt_batch_init(gpt_batch_t *b, gpt_loop_t *loop, FILE *in, FILE *out, int jobs) {
+    memset(b, 0, sizeof(*b));
+    b->loop = loop;
+    b->in = in;
+    b->out = out;
+    b->jobs = jobs > 0 ? jobs : GPT_BATCH_JOBS;
+    strncpy(b->param.model, GPT_MODEL, sizeof(b->param.model));
+    b->param.temperature = 0.7;
+    return 0;
+}
+
+void
+gpt_batch_free(gpt_batch_t *b) {
+    struct batch_result *r;
+
+    while ((r = b->pending) != NULL) {
+        b->pending = r->next;
+        gpt_buf_free(&r->line);
+        free(r);
+    }
+    free(b->line);
+    b->line = NULL;
+}
+
+static void
+_gpt_batch_job_free(struct batch_job *job) {
+    free(job->id);
+    free(job->system);
+    free(job->prompt);
+    gpt_buf_free(&job->req);
+    free(job);
+}
+
+/*
+ * A JSON object line gives id, prompt and system,
+ * anything else is the prompt itself
+ */
+static int
+_gpt_batch_parse(struct batch_job *job, const char *line, size_t len, long lineno) {
+    cJSON  *root = NULL, *item;
+    char    id[32];
+
+    if (line[0] == '{' && (root = cJSON_ParseWithLength(line, len)) != NULL
+        && cJSON_IsString(item = cJSON_GetObjectItem(root, "prompt"))) {
+        job->prompt = strdup(item->valuestring);
+        if ((item = cJSON_GetObjectItem(root, "id")) != NULL)
+            job->id = cJSON_PrintUnformatted(item);
+        if (cJSON_IsString(item = cJSON_GetObjectItem(root, "system")))
+            job->system = strdup(item->valuestring);
+    } else {
+        job->prompt = strndup(line, len);
+    }
+    cJSON_Delete(root);
+    if (job->id == NULL) {
+        snprintf(id, sizeof(id), "%ld", lineno);
+        job->id = strdup(id);
+    }
+    return job->prompt != NULL && job->id != NULL ? 0 : -1;
+}
+
+/*
+ * Take the next prompt and build its request, return NULL at the end
+ * of the input. A line that cannot be taken still gets a job, which
+ * writes its error result in order.
+ */
+static struct batch_job *
+_gpt_batch_next(gpt_batch_t *b) {
+    struct batch_job   *job;
+    const char         *system;
+    ssize_t             n;
+
+    while (!b->eof) {
+        if ((n = getline(&b->line, &b->cap, b->in)) == -1) {
+            b->eof = 1;
+            break;
+        }
+        b->lineno++;
+        while (n > 0 && (b->line[n - 1] == '\n' || b->line[n - 1] == '\r'))
+            n--;
+        if (n == 0)
+            continue;
+
+        if ((job = (struct batch_job *)calloc(1, sizeof(*job))) == NULL) {
+            fprintf(stderr, "(cgpt): out of memory at line %ld of the batch\n", b->lineno);
+            b->eof = 1;
+            b->failed++;
+            return NULL;
+        }
+        job->batch = b;
+        job->lineno = b->lineno;
+        job->seq = b->next_in++;
+        if (_gpt_batch_parse(job, b->line, n, b->lineno) == -1) {
+            fprintf(stderr, "(cgpt): line %ld of the batch could not be read\n", b->lineno);
+            job->error = "invalid prompt line";
+            return job;
+        }
+
+        system = job->system ? job->system : b->system;
+        gpt_json_head(&b->param, &job->req);
+        if (system != NULL && *system != '\0') {
+            gpt_json_message(&job->req, "system", system, strlen(system));
+            gpt_buf_append(&job->req, ",", 1);
+        }
+        gpt_json_message(&job->req, "user", job->prompt, strlen(job->prompt));
+        gpt_json_tail(&job->req);
+        return job;
+    }
+    return NULL;
+}
+
+/*
+ * Queue the result line of seq and write
+ * every result that is now next in order
+ */
+static void
+_gpt_batch_emit(gpt_batch_t *b, struct batch_result *res) {
+    struct batch_result **pp, *r;
+
+    for (pp = &b->pending; *pp != NULL && (*pp)->seq < res->seq; pp = &(*pp)->next)
+        ;
+    res->next = *pp;
+    *pp = res;
+
+    while ((r = b->pending) != NULL && r->seq == b->next_out) {
+        fwrite(r->line.data, 1, r->line.len, b->out);
+        b->pending = r->next;
+        b->next_out++;
+        gpt_buf_free(&r->line);
+        free(r);
+    }
+    fflush(b->out);
+}
+
+/*
+ * Turn the reply into the result line, or write error if there
+ * is none, return 0 for a completion
+ */
+static int
+_gpt_batch_result(gpt_buf_t *out, const char *id, gpt_buf_t *body, const char *error,
+                  gpt_usage_t *usage) {
+    gpt_view_t  v;
+    char        line[128];
+    int         rc = -1;
+
+    gpt_buf_puts(out, "{\"id\":");
+    gpt_buf_puts(out, id);
+    if (error != NULL) {
+        gpt_buf_puts(out, ",\"error\":");
+        gpt_json_escape(out, error, strlen(error));
+        gpt_buf_puts(out, "}\n");
+        return -1;
+    }
+
+    /* the view takes the body buffer over */
+    switch (gpt_json_view(body->data, body->len, &v)) {
+    case 0:
+        gpt_buf_puts(out, ",\"content\":");
+        if (v.choices_num > 0)
+            gpt_json_escape(out, v.choices[0].content.s, v.choices[0].content.len);
+        else
+            gpt_buf_puts(out, "\"\"");
+        snprintf(line, sizeof(line),
+                ",\"usage\":{\"prompt_tokens\":%d,\"completion_tokens\":%d}}\n",
+                v.usage.prompt_tokens, v.usage.completion_tokens);
+        gpt_buf_puts(out, line);
+        *usage = v.usage;
+        rc = 0;
+        break;
+    case 1:
+        gpt_buf_puts(out, ",\"error\":");
+        gpt_json_escape(out, v.message.s, v.message.len);
+        gpt_buf_puts(out, "}\n");
+        break;
+    default:
+        gpt_buf_puts(out, ",\"error\":\"unexpected response\"}\n");
+        break;
+    }
+    gpt_json_view_free(&v);
+    memset(body, 0, sizeof(*body));
+    return rc;
+}
+
+/*
+ * The job is over (call is NULL if it never started), write its
+ * result and start the next prompts
+ */
+static void
+_gpt_batch_finish(struct batch_job *job, gpt_call_t *call) {
+    gpt_batch_t         *b = job->batch;
+    struct batch_result *res;
+    gpt_buf_t            body = {0};
+    gpt_usage_t          usage = {0};
+    const char          *error = job->error ? job->error : "request failed";
+    char                 id[32];
+    int                  replayed = 0;
+
+    if (call != NULL) {
+        replayed = call->replayed;
+        if (call->rc == 0 && call->rsp.body.len > 0) {
+            body = call->rsp.body;
+            memset(&call->rsp.body, 0, sizeof(call->rsp.body));
+            error = NULL;
+        }
+        gpt_call_free(call);
+        b->running--;
+    }
+
+    if ((res = (struct batch_result *)calloc(1, sizeof(*res))) != NULL) {
+        res->seq = job->seq;
+        /* the id of a line that could not be taken may be missing */
+        snprintf(id, sizeof(id), "%ld", job->lineno);
+        if (_gpt_batch_result(&res->line, job->id ? job->id : id, &body, error, &usage) == 0)
+            b->ok++;
+        else
+            b->failed++;
+        _gpt_batch_emit(b, res);
+    }
+    /*
+     * what the server counted corrects the estimate, a reply
+     * from the cache or another request cost nothing
+     */
+    if (b->limit != NULL && replayed)
+        gpt_limit_settle(b->limit, job->tokens, 0, 0);
+    else if (b->limit != NULL && usage.total_tokens > 0)
+        gpt_limit_settle(b->limit, job->tokens, usage.prompt_tokens, usage.completion_tokens);
+    gpt_buf_free(&body);
+    _gpt_batch_job_free(job);
+    _gpt_batch_fill(b);
+}
+
+static void
+_gpt_batch_done(gpt_call_t *call) {
+    _gpt_batch_finish((struct batch_job *)call->arg, call);
+}
+
+static void
+_gpt_batch_start(struct batch_job *job) {
+    gpt_batch_t *b = job->batch;
+
+    if (b->start(&job->req, NULL, job->tokens, _gpt_batch_done, job) == NULL) {
+        b->running--;
+        _gpt_batch_finish(job, NULL);
+    }
+}
+
+static void
+_gpt_batch_admit(gpt_wait_t *w) {
+    _gpt_batch_start((struct batch_job *)w->arg);
+}
+
+/*
+ * Tokens of the request as the server counts them, reply included
+ */
+static long
+_gpt_batch_tokens(gpt_batch_t *b, struct batch_job *job) {
+    const char *system = job->system ? job->system : b->system;
+    long        n = GPT_TOKEN_PRIMING + GPT_TOKEN_MESSAGE;
+
+    n += gpt_token_count(b->vocab, job->prompt, strlen(job->prompt));
+    if (system != NULL && *system != '\0')
+        n += GPT_TOKEN_MESSAGE + gpt_token_count(b->vocab, system, strlen(system));
+    return gpt_limit_estimate(b->limit, n);
+}
+
+/*
+ * Keep jobs requests in flight, reading stops while too
+ * many results are held back behind a slow request. A job
+ * waiting for the rate limit holds its place.
+ */
+static void
+_gpt_batch_fill(gpt_batch_t *b) {
+    struct batch_job   *job;
+
+    if (b->filling)
+        return;
+    b->filling = 1;
+    while (b->running < b->jobs
+           && b->next_in - b->next_out < (long)b->jobs * GPT_BATCH_WINDOW
+           && (job = _gpt_batch_next(b)) != NULL) {
+        if (job->error != NULL) {
+            _gpt_batch_finish(job, NULL);
+            continue;
+        }
+        b->running++;
+        /*
+         * a cached reply or a duplicate of a request in
+         * flight costs nothing, it is not rate limited
+         */
+        if (b->limit != NULL
+            && (b->cache == NULL || !gpt_cache_has(b->cache, job->req.data, job->req.len))
+            && (b->flight == NULL || !gpt_flight_has(b->flight, job->req.data, job->req.len))) {
+            job->tokens = _gpt_batch_tokens(b, job);
+            if (gpt_limit_acquire(b->limit, &job->wait, job->tokens, _gpt_batch_admit, job) == 1)
+                continue;
+        }
+        _gpt_batch_start(job);
+    }
+    b->filling = 0;
+}
+
+int
+gpt_batch_run(gpt_batch_t *b) {
+    _gpt_batch_fill(b);
+    while (b->running > 0) {
+        if (gpt_loop_once(b->loop, -1) == -1)
+            return -1;
+    }
+    return b->failed == 0 && b->eof ? 0 : -1;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ * Batch mode: every line of the input is an independent prompt, either
+ * plain text or {"id": ..., "prompt": "...", "system": "..."}. Up to jobs
+ * requests are in flight on the event loop, results are written one JSON
+ * line each in input order: {"id": ..., "content": "...", "usage": {...}}
+ * or {"id": ..., "error": "..."}. Lines without an id get their line number.
+ */
+#ifndef __GPT_BATCH__
+#define __GPT_BATCH__
+
+#include <gpt_config.h>
+
+#define GPT_BATCH_JOBS      4       /* requests in flight by default */
+#define GPT_BATCH_WINDOW    64      /* results held back per job waiting for an earlier one */
+
+struct batch_result {
+    long                 seq;
+    gpt_buf_t            line;
+    struct batch_result *next;
+};
+
+struct batch {
+    gpt_loop_t          *loop;
+    FILE                *in;
+    FILE                *out;
+    int                  jobs;
+    const char          *system;    /* default system message, may be NULL */
+    gpt_request_t        param;     /* model and temperature */
+    gpt_limit_t         *limit;     /* admits the requests, NULL for no rate limit */
+    gpt_vocab_t         *vocab;     /* token counts of the estimates, may be NULL */
+    gpt_flight_t        *flight;    /* requests the start function joins, may be NULL */
+    gpt_cache_t         *cache;     /* replies the start function replays, may be NULL */
+    /*
+     * start a request on loop that the rate limit admitted with
+     * tokens, NULL if it could not be started
+     */
+    gpt_call_t        *(*start)(const gpt_buf_t *req, gpt_sse_t *sse, long tokens,
+                                void (*done)(gpt_call_t *call), void *arg);
+
+    int                  running;   /* requests in flight */
+    int                  filling;
+    char                *line;
+    size_t               cap;
+    long                 lineno;
+    int                  eof;
+    long                 next_in;   /* sequence number of the next prompt */
+    long                 next_out;  /* sequence number of the next result written */
+    struct batch_result *pending;   /* finished out of order, sorted by seq */
+    long                 ok;
+    long                 failed;
+};
+
+int gpt_batch_init(gpt_batch_t *b, gpt_loop_t *loop, FILE *in, FILE *out, int jobs);
+/*
+ * Run every prompt of the input, return 0 if all of
+ * them got a completion, otherwise return -1
+ */
+int gpt_batch_run(gpt_batch_t *b);
+void gpt_batch_free(gpt_batch_t *b);
+
+#endif
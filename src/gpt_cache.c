@@ -0,0 +1,606 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ */
+#include <gpt_config.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/uio.h>
+
+#define GPT_CACHE_MAGIC     "cgptdat1"
+#define GPT_CACHE_IMAGIC    "cgptidx1"
+#define GPT_CACHE_RECORD    0x63726331      /* "crc1" */
+#define GPT_CACHE_ALIGN(n)  (((n) + 7) & ~(size_t)7)
+
+/*
+ * Start of the data file, the id changes whenever the file is
+ * rewritten so an index left from another file is never trusted
+ */
+struct cache_head {
+    char        magic[8];
+    uint64_t    id;
+};
+
+/*
+ * Every reply in the data file, padded to 8 bytes
+ */
+struct cache_record {
+    uint32_t    magic;
+    uint32_t    crc;        /* of key, len and the reply */
+    uint32_t    len;        /* bytes of the reply that follows */
+    uint32_t    pad;
+    uint8_t     key[GPT_CACHE_KEY];
+};
+
+/*
+ * Start of the index file, an open addressing table of slots follows
+ */
+struct cache_index {
+    char        magic[8];
+    uint64_t    id;         /* of the data file indexed */
+    uint64_t    end;        /* data bytes indexed, records past it are recovered */
+    uint32_t    slots;      /* power of two */
+    uint32_t    count;
+};
+
+struct cache_slot {
+    uint8_t     key[GPT_CACHE_KEY];
+    uint64_t    off;        /* of the record, 0 for a free slot */
+    uint32_t    len;
+    uint32_t    used;       /* last hit in seconds, orders eviction */
+};
+
+static pthread_once_t   _gpt_cache_once = PTHREAD_ONCE_INIT;
+static uint32_t         _gpt_cache_crctab[256];
+
+static void
+_gpt_cache_crcinit(void) {
+    uint32_t c;
+
+    for (uint32_t i = 0; i < 256; i++) {
+        c = i;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        _gpt_cache_crctab[i] = c;
+    }
+}
+
+static uint32_t
+_gpt_cache_crc(uint32_t crc, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+
+    crc = ~crc;
+    while (len--)
+        crc = _gpt_cache_crctab[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint32_t
+_gpt_cache_sum(const struct cache_record *r, const char *data) {
+    uint32_t crc = _gpt_cache_crc(0, r->key, sizeof(r->key));
+
+    crc = _gpt_cache_crc(crc, &r->len, sizeof(r->len));
+    return _gpt_cache_crc(crc, data, r->len);
+}
+
+void
+gpt_cache_key(const char *data, size_t len, uint8_t key[GPT_CACHE_KEY]) {
+    /* FNV-1a, 128 bit */
+    unsigned __int128 h = ((unsigned __int128)0x6c62272e07bb0142ULL << 64) | 0x62b821756295c58dULL;
+    unsigned __int128 prime = ((unsigned __int128)1 << 88) | 0x13b;
+
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)data[i];
+        h *= prime;
+    }
+    for (int i = 0; i < GPT_CACHE_KEY; i++) {
+        key[i] = (uint8_t)h;
+        h >>= 8;
+    }
+}
+
+/*
+ * Key of the body key for the endpoint of c, the same
+ * body sent elsewhere may get another reply
+ */
+static void
+_gpt_cache_scoped(gpt_cache_t *c, const uint8_t key[GPT_CACHE_KEY], uint8_t out[GPT_CACHE_KEY]) {
+    char    buf[GPT_CACHE_KEY * 2];
+
+    memcpy(buf, c->scope, GPT_CACHE_KEY);
+    memcpy(buf + GPT_CACHE_KEY, key, GPT_CACHE_KEY);
+    gpt_cache_key(buf, sizeof(buf), out);
+}
+
+static void
+_gpt_cache_path(gpt_cache_t *c, const char *name, int tmp, char *path, size_t size) {
+    if (tmp)
+        snprintf(path, size, "%s/%s.%d", c->dir, name, (int)getpid());
+    else
+        snprintf(path, size, "%s/%s", c->dir, name);
+}
+
+static struct cache_slot *
+_gpt_cache_probe(struct cache_index *idx, const uint8_t key[GPT_CACHE_KEY]) {
+    struct cache_slot  *s = (struct cache_slot *)(idx + 1);
+    uint64_t            h;
+    uint32_t            i, n;
+
+    memcpy(&h, key, sizeof(h));
+    for (i = h & (idx->slots - 1), n = 0; n < idx->slots; i = (i + 1) & (idx->slots - 1), n++) {
+        if (s[i].off == 0 || memcmp(s[i].key, key, GPT_CACHE_KEY) == 0)
+            return &s[i];
+    }
+    return NULL;
+}
+
+static void
+_gpt_cache_set(struct cache_index *idx, const uint8_t key[GPT_CACHE_KEY],
+               uint64_t off, uint32_t len, uint32_t used) {
+    struct cache_slot *s;
+
+    if ((s = _gpt_cache_probe(idx, key)) == NULL)
+        return;
+    if (s->off == 0)
+        idx->count++;
+    memcpy(s->key, key, GPT_CACHE_KEY);
+    s->len = len;
+    s->used = used;
+    s->off = off;
+}
+
+/*
+ * The record at off if it is whole (padding included, the next one
+ * starts after it) and its checksum matches, key is checked unless
+ * it is NULL
+ */
+static const struct cache_record *
+_gpt_cache_record(gpt_cache_t *c, uint64_t off, const uint8_t *key) {
+    const struct cache_record *r;
+
+    if (off < sizeof(struct cache_head) || off > c->dsize || c->dsize - off < sizeof(*r))
+        return NULL;
+    r = (const struct cache_record *)(c->data + off);
+    if (r->magic != GPT_CACHE_RECORD || GPT_CACHE_ALIGN(sizeof(*r) + (size_t)r->len) > c->dsize - off
+        || (key != NULL && memcmp(r->key, key, GPT_CACHE_KEY) != 0)
+        || r->crc != _gpt_cache_sum(r, (const char *)(r + 1)))
+        return NULL;
+    return r;
+}
+
+/*
+ * Map the data file again once it has grown
+ */
+static int
+_gpt_cache_remap(gpt_cache_t *c) {
+    struct stat st;
+    void       *p;
+
+    if (fstat(c->dfd, &st) == -1)
+        return -1;
+    if ((size_t)st.st_size == c->dsize)
+        return 0;
+    if (c->data != NULL)
+        munmap(c->data, c->dsize);
+    c->data = NULL;
+    c->dsize = 0;
+    if ((p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, c->dfd, 0)) == MAP_FAILED)
+        return -1;
+    c->data = (char *)p;
+    c->dsize = c->size = st.st_size;
+    return 0;
+}
+
+static int
+_gpt_cache_mapindex(gpt_cache_t *c) {
+    struct cache_index *idx;
+    struct stat         st;
+    void               *p;
+
+    if (fstat(c->ifd, &st) == -1 || (size_t)st.st_size < sizeof(*idx))
+        return -1;
+    if ((p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, c->ifd, 0)) == MAP_FAILED)
+        return -1;
+    c->index = idx = (struct cache_index *)p;
+    c->isize = st.st_size;
+    c->ino = st.st_ino;
+    if (memcmp(idx->magic, GPT_CACHE_IMAGIC, sizeof(idx->magic)) != 0
+        || idx->slots == 0 || (idx->slots & (idx->slots - 1)) != 0 || idx->count >= idx->slots
+        || c->isize != sizeof(*idx) + (size_t)idx->slots * sizeof(struct cache_slot))
+        return -1;
+    return 0;
+}
+
+static void
+_gpt_cache_unmap(gpt_cache_t *c) {
+    if (c->index != NULL)
+        munmap(c->index, c->isize);
+    if (c->data != NULL)
+        munmap(c->data, c->dsize);
+    if (c->ifd != -1)
+        close(c->ifd);
+    if (c->dfd != -1)
+        close(c->dfd);
+    c->index = NULL;
+    c->data = NULL;
+    c->isize = c->dsize = 0;
+    c->ifd = c->dfd = -1;
+}
+
+/*
+ * Make a new empty index of the data file id aside and switch to it,
+ * the caller fills it and renames it into place
+ */
+static int
+_gpt_cache_newindex(gpt_cache_t *c, uint32_t slots, uint64_t id) {
+    struct cache_index  idx;
+    char                path[PATH_MAX + 16];
+    int                 fd;
+
+    memset(&idx, 0, sizeof(idx));
+    memcpy(idx.magic, GPT_CACHE_IMAGIC, sizeof(idx.magic));
+    idx.id = id;
+    idx.end = sizeof(struct cache_head);
+    idx.slots = slots;
+
+    _gpt_cache_path(c, "index", 1, path, sizeof(path));
+    if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) == -1)
+        return -1;
+    if (ftruncate(fd, sizeof(idx) + (off_t)slots * sizeof(struct cache_slot)) == -1
+        || pwrite(fd, &idx, sizeof(idx), 0) != sizeof(idx)) {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    if (c->index != NULL)
+        munmap(c->index, c->isize);
+    if (c->ifd != -1)
+        close(c->ifd);
+    c->index = NULL;
+    c->ifd = fd;
+    if (_gpt_cache_mapindex(c) == -1) {
+        unlink(path);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+_gpt_cache_rename(gpt_cache_t *c, const char *name) {
+    char    tmp[PATH_MAX + 16], path[PATH_MAX];
+
+    _gpt_cache_path(c, name, 1, tmp, sizeof(tmp));
+    _gpt_cache_path(c, name, 0, path, sizeof(path));
+    if (rename(tmp, path) == -1) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Move every entry to an index of twice the slots
+ */
+static int
+_gpt_cache_grow(gpt_cache_t *c) {
+    struct cache_index *old = c->index;
+    struct cache_slot  *s = (struct cache_slot *)(old + 1);
+    size_t              isize = c->isize;
+    int                 ifd = c->ifd;
+
+    c->index = NULL;
+    c->ifd = -1;
+    if (_gpt_cache_newindex(c, old->slots * 2, old->id) == -1) {
+        c->index = old;
+        c->isize = isize;
+        c->ifd = ifd;
+        return -1;
+    }
+    for (uint32_t i = 0; i < old->slots; i++) {
+        if (s[i].off != 0)
+            _gpt_cache_set(c->index, s[i].key, s[i].off, s[i].len, s[i].used);
+    }
+    c->index->end = old->end;
+    munmap(old, isize);
+    close(ifd);
+    return _gpt_cache_rename(c, "index");
+}
+
+static void
+_gpt_cache_add(gpt_cache_t *c, const uint8_t key[GPT_CACHE_KEY], uint64_t off, uint32_t len) {
+    _gpt_cache_set(c->index, key, off, len, (uint32_t)time(NULL));
+    if (c->index->count >= c->index->slots / 4 * 3)
+        _gpt_cache_grow(c);
+}
+
+/*
+ * Index the records appended after the index was last updated,
+ * a record cut short by a crash is dropped with all after it
+ */
+static void
+_gpt_cache_recover(gpt_cache_t *c) {
+    const struct cache_record  *r;
+    uint64_t                    off = c->index->end;
+
+    while (off < c->dsize && (r = _gpt_cache_record(c, off, NULL)) != NULL) {
+        _gpt_cache_add(c, r->key, off, r->len);
+        off += GPT_CACHE_ALIGN(sizeof(*r) + r->len);
+    }
+    if (off < c->dsize && ftruncate(c->dfd, off) == 0)
+        _gpt_cache_remap(c);
+    c->index->end = off;
+}
+
+/*
+ * Open and map the data file and its index, called with the lock held.
+ * Only the records the index does not cover yet are read.
+ */
+static int
+_gpt_cache_load(gpt_cache_t *c) {
+    struct cache_head   head;
+    char                path[PATH_MAX];
+    uint64_t            id;
+
+    _gpt_cache_path(c, "data", 0, path, sizeof(path));
+    if ((c->dfd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) == -1)
+        return -1;
+    if (pread(c->dfd, &head, sizeof(head), 0) != sizeof(head)
+        || memcmp(head.magic, GPT_CACHE_MAGIC, sizeof(head.magic)) != 0) {
+        memcpy(head.magic, GPT_CACHE_MAGIC, sizeof(head.magic));
+        head.id = ((uint64_t)time(NULL) << 20) ^ (uint64_t)getpid();
+        if (ftruncate(c->dfd, 0) == -1 || pwrite(c->dfd, &head, sizeof(head), 0) != sizeof(head))
+            return -1;
+    }
+    if (_gpt_cache_remap(c) == -1)
+        return -1;
+    id = head.id;
+
+    _gpt_cache_path(c, "index", 0, path, sizeof(path));
+    if ((c->ifd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) == -1)
+        return -1;
+    if (_gpt_cache_mapindex(c) == -1 || c->index->id != id || c->index->end > c->dsize) {
+        /* lost or left from another data file, built again from the records */
+        if (_gpt_cache_newindex(c, GPT_CACHE_SLOTS, id) == -1
+            || _gpt_cache_rename(c, "index") == -1)
+            return -1;
+    }
+    _gpt_cache_recover(c);
+    return 0;
+}
+
+/*
+ * Another process may have replaced the files, follow it
+ */
+static int
+_gpt_cache_sync(gpt_cache_t *c) {
+    char        path[PATH_MAX];
+    struct stat st;
+
+    _gpt_cache_path(c, "index", 0, path, sizeof(path));
+    if (c->index != NULL && stat(path, &st) == 0 && st.st_ino == c->ino) {
+        if (_gpt_cache_remap(c) == -1)
+            return -1;
+        _gpt_cache_recover(c);
+        return 0;
+    }
+    _gpt_cache_unmap(c);
+    return _gpt_cache_load(c);
+}
+
+gpt_cache_t *
+gpt_cache_open(const char *dir, size_t max, const char *target) {
+    gpt_cache_t *c;
+    char         path[PATH_MAX];
+    int          rc;
+
+    pthread_once(&_gpt_cache_once, _gpt_cache_crcinit);
+    if (mkdirp(dir, 0700) == -1 && errno != EEXIST)
+        return NULL;
+    if ((c = (gpt_cache_t *)calloc(1, sizeof(*c))) == NULL)
+        return NULL;
+    c->ifd = c->dfd = c->lfd = -1;
+    c->max = max;
+    gpt_cache_key(target, strlen(target), c->scope);
+    if ((c->dir = strdup(dir)) == NULL)
+        goto fail;
+    _gpt_cache_path(c, "lock", 0, path, sizeof(path));
+    if ((c->lfd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) == -1)
+        goto fail;
+    flock(c->lfd, LOCK_EX);
+    rc = _gpt_cache_load(c);
+    flock(c->lfd, LOCK_UN);
+    if (rc == 0)
+        return c;
+fail:
+    gpt_cache_close(c);
+    return NULL;
+}
+
+void
+gpt_cache_close(gpt_cache_t *c) {
+    if (c == NULL)
+        return;
+    _gpt_cache_unmap(c);
+    if (c->lfd != -1)
+        close(c->lfd);
+    free(c->dir);
+    free(c);
+}
+
+/*
+ * Lookups take no lock: a slot being written by another process
+ * may be seen half done, the key and checksum of the record catch it
+ */
+int
+gpt_cache_get(gpt_cache_t *c, const uint8_t body[GPT_CACHE_KEY], gpt_buf_t *out) {
+    const struct cache_record  *r;
+    struct cache_slot          *s;
+    uint8_t                     key[GPT_CACHE_KEY];
+
+    _gpt_cache_scoped(c, body, key);
+    if (c->index == NULL || (s = _gpt_cache_probe(c->index, key)) == NULL || s->off == 0) {
+        c->misses++;
+        return -1;
+    }
+    /* appended since the data file was mapped */
+    if (s->off + sizeof(*r) + s->len > c->dsize)
+        _gpt_cache_remap(c);
+    if ((r = _gpt_cache_record(c, s->off, key)) == NULL) {
+        c->misses++;
+        return -1;
+    }
+    gpt_buf_append(out, (const char *)(r + 1), r->len);
+    s->used = (uint32_t)time(NULL);
+    c->hits++;
+    return 0;
+}
+
+int
+gpt_cache_has(gpt_cache_t *c, const char *body, size_t len) {
+    uint8_t             key[GPT_CACHE_KEY];
+    struct cache_slot  *s;
+
+    gpt_cache_key(body, len, key);
+    _gpt_cache_scoped(c, key, key);
+    if (c->index == NULL || (s = _gpt_cache_probe(c->index, key)) == NULL || s->off == 0)
+        return 0;
+    if (s->off + sizeof(struct cache_record) + s->len > c->dsize)
+        _gpt_cache_remap(c);
+    return _gpt_cache_record(c, s->off, key) != NULL;
+}
+
+static int
+_gpt_cache_write(int fd, uint64_t off, const struct cache_record *r, const char *data) {
+    static const char   zero[8];
+    struct iovec        iov[3];
+    size_t              len = GPT_CACHE_ALIGN(sizeof(*r) + r->len);
+
+    iov[0].iov_base = (void *)r;
+    iov[0].iov_len = sizeof(*r);
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = r->len;
+    iov[2].iov_base = (void *)zero;
+    iov[2].iov_len = len - sizeof(*r) - r->len;
+    return pwritev(fd, iov, 3, off) == (ssize_t)len ? 0 : -1;
+}
+
+static int
+_gpt_cache_newer(const void *a, const void *b) {
+    const struct cache_slot *x = (const struct cache_slot *)a;
+    const struct cache_slot *y = (const struct cache_slot *)b;
+
+    /* within a second the later record is the newer one */
+    if (x->used != y->used)
+        return x->used > y->used ? -1 : 1;
+    return x->off > y->off ? -1 : x->off < y->off;
+}
+
+/*
+ * Rewrite the data file with the most recently used entries
+ * until it takes half the cap, so appends run a while before
+ * the next compaction
+ */
+static int
+_gpt_cache_compact(gpt_cache_t *c) {
+    const struct cache_record  *r;
+    struct cache_slot          *s = (struct cache_slot *)(c->index + 1), *live;
+    struct cache_head           head;
+    char                        tmp[PATH_MAX + 16];
+    uint32_t                    slots = c->index->slots, n = 0;
+    uint64_t                    off = sizeof(head);
+    int                         fd;
+
+    if ((live = (struct cache_slot *)malloc(c->index->count * sizeof(*live) + 1)) == NULL)
+        return -1;
+    for (uint32_t i = 0; i < slots && n < c->index->count; i++) {
+        if (s[i].off != 0 && _gpt_cache_record(c, s[i].off, s[i].key) != NULL)
+            live[n++] = s[i];
+    }
+    qsort(live, n, sizeof(*live), _gpt_cache_newer);
+
+    memcpy(head.magic, GPT_CACHE_MAGIC, sizeof(head.magic));
+    head.id = ((struct cache_head *)c->data)->id + 1;
+    _gpt_cache_path(c, "data", 1, tmp, sizeof(tmp));
+    if ((fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) == -1
+        || pwrite(fd, &head, sizeof(head), 0) != sizeof(head)) {
+        free(live);
+        goto fail;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        r = (const struct cache_record *)(c->data + live[i].off);
+        if (off + GPT_CACHE_ALIGN(sizeof(*r) + r->len) > c->max / 2
+            || _gpt_cache_write(fd, off, r, (const char *)(r + 1)) == -1) {
+            n = i;
+            break;
+        }
+        live[i].off = off;
+        off += GPT_CACHE_ALIGN(sizeof(*r) + r->len);
+    }
+
+    if (_gpt_cache_newindex(c, slots, head.id) == -1) {
+        free(live);
+        goto fail;
+    }
+    for (uint32_t i = 0; i < n; i++)
+        _gpt_cache_set(c->index, live[i].key, live[i].off, live[i].len, live[i].used);
+    c->index->end = off;
+    free(live);
+
+    /* either order of a crash leaves an id mismatch, the index is then rebuilt */
+    if (_gpt_cache_rename(c, "data") == -1 || _gpt_cache_rename(c, "index") == -1) {
+        close(fd);
+        return _gpt_cache_sync(c);
+    }
+    if (c->data != NULL)
+        munmap(c->data, c->dsize);
+    close(c->dfd);
+    c->data = NULL;
+    c->dsize = 0;
+    c->dfd = fd;
+    return _gpt_cache_remap(c);
+fail:
+    if (fd != -1)
+        close(fd);
+    unlink(tmp);
+    return _gpt_cache_sync(c);
+}
+
+int
+gpt_cache_put(gpt_cache_t *c, const uint8_t body[GPT_CACHE_KEY],
+              const char *data, size_t len) {
+    struct cache_record r;
+    uint64_t            off;
+    uint8_t             key[GPT_CACHE_KEY];
+    int                 rc = -1;
+
+    /* compaction keeps half the cap, a bigger record would only thrash */
+    if (len > UINT32_MAX
+        || sizeof(struct cache_head) + GPT_CACHE_ALIGN(sizeof(r) + len) > c->max / 2)
+        return -1;
+    _gpt_cache_scoped(c, body, key);
+    memset(&r, 0, sizeof(r));
+    r.magic = GPT_CACHE_RECORD;
+    r.len = (uint32_t)len;
+    memcpy(r.key, key, GPT_CACHE_KEY);
+    r.crc = _gpt_cache_sum(&r, data);
+
+    /* writers append one at a time, across processes too */
+    flock(c->lfd, LOCK_EX);
+    if (_gpt_cache_sync(c) == -1)
+        goto done;
+    off = c->dsize;
+    if (_gpt_cache_write(c->dfd, off, &r, data) == -1 || _gpt_cache_remap(c) == -1) {
+        /* recovery would stop at a partly written record anyway */
+        if (ftruncate(c->dfd, off) == 0)
+            _gpt_cache_remap(c);
+        goto done;
+    }
+    /* the record is whole before the index points at it */
+    _gpt_cache_add(c, key, off, r.len);
+    c->index->end = c->dsize;
+    if (c->dsize > c->max)
+        _gpt_cache_compact(c);
+    rc = 0;
+done:
+    flock(c->lfd, LOCK_UN);
+    return rc;
+}
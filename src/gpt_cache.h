@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ * Response cache: replies are stored under a 128-bit FNV-1a hash of the
+ * endpoint and the request body (model, temperature and messages). The cache directory
+ * holds an append-only data file of checksummed records and an open
+ * addressing hash index, both memory-mapped: a lookup is a probe and a
+ * pointer into the data. Opening reads only the records appended after
+ * the index was last updated. Once the data grows beyond the size cap it
+ * is rewritten with the most recently used entries.
+ */
+#ifndef __GPT_CACHE__
+#define __GPT_CACHE__
+
+#include <gpt_config.h>
+
+#define GPT_CACHE_KEY       16          /* bytes of a key */
+#define GPT_CACHE_SIZE      64          /* MB the cache may take by default */
+#define GPT_CACHE_SLOTS     1024        /* index slots of a new cache, doubled at 3/4 full */
+
+struct cache {
+    char               *dir;
+    size_t              max;        /* bytes the data file may take */
+    size_t              size;       /* bytes it takes now */
+    long                hits;
+    long                misses;
+    int                 lfd;        /* locked by writers */
+    int                 ifd;
+    int                 dfd;
+    ino_t               ino;        /* of the index, replaced by other writers */
+    uint8_t             scope[GPT_CACHE_KEY];   /* hash of the endpoint, part of every key */
+    struct cache_index *index;      /* mapped index file */
+    size_t              isize;
+    char               *data;       /* mapped data file */
+    size_t              dsize;
+};
+
+/*
+ * Open (create) the cache in dir for the replies of target (the
+ * endpoint the requests go to). Return NULL if it can not be used
+ */
+gpt_cache_t *gpt_cache_open(const char *dir, size_t max, const char *target);
+void gpt_cache_close(gpt_cache_t *c);
+void gpt_cache_key(const char *data, size_t len, uint8_t key[GPT_CACHE_KEY]);
+/*
+ * Look key (of the request body) up, the reply is appended to out.
+ * Return 0 on a hit, otherwise return -1
+ */
+int gpt_cache_get(gpt_cache_t *c, const uint8_t key[GPT_CACHE_KEY], gpt_buf_t *out);
+/*
+ * Whether the reply of the request body is cached, a probe
+ * that neither counts nor refreshes the entry
+ */
+int gpt_cache_has(gpt_cache_t *c, const char *body, size_t len);
+/*
+ * Store the reply of key. A reply compaction could not keep (more
+ * than half the cap) is not stored. Return 0 if successful,
+ * otherwise return -1
+ */
+int gpt_cache_put(gpt_cache_t *c, const uint8_t key[GPT_CACHE_KEY],
+                  const char *data, size_t len);
+
+#endif
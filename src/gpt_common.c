@@ -3,7 +3,6 @@
  */
 #include <gpt_config.h>
 
-#define GF_PRI_SUSECONDS "06ld"
 #ifdef _WIN32
 #define PATH_SEPARATOR   '\\'
 #else
@@ -30,6 +29,29 @@ static const char *__gf_zerotimes[] = {
     "0",
 };
 
+/* formats whose text ends in the two digits of the seconds */
+static const char __gf_timesecs[] = {1, 1, 1, 1, 1, 0, 0};
+
+/*
+ * Last time formatted by this thread. The text stays valid for
+ * the whole minute, the next second only rewrites its last two
+ * digits; formats without seconds at the end are redone each second.
+ * This holds only while local time is a whole number of minutes off
+ * UTC, so that a UTC minute is also a local one: each conversion
+ * checks it and a zone that is not is converted every second
+ */
+struct gf_timecache {
+    time_t          sec;
+    unsigned int    fmt;
+    int             minute;     /* local seconds are the UTC ones */
+    size_t          len;        /* text before the fraction */
+    size_t          tzlen;
+    char            text[64];
+    char            tz[16];     /* " +hhmm" */
+};
+
+static __thread struct gf_timecache __gf_timecache = { .sec = 0, .fmt = (unsigned int)-1 };
+
 static void
 _gf_timestuff(const char ***fmts, const char ***zeros)
 {
@@ -38,24 +60,25 @@ _gf_timestuff(const char ***fmts, const char ***zeros)
 }
 
 /*
- * return address of value equel dst
+ * Bring the cache of this thread to sec, return -1 if
+ * the time could not be converted
  */
-static inline char *
-gf_time_fmt_tv(char *dst, size_t sz_dst, struct timeval *tv, unsigned int fmt)
+static int
+_gf_timecache(struct gf_timecache *c, time_t sec, unsigned int fmt)
 {
-    static gf_timefmts timefmt_last = (gf_timefmts)-1;
-    static const char **fmts;
-    static const char **zeros;
-    struct tm tm, *res;
-    int len = 0;
-    int pos = 0;
-
-    if (timefmt_last == ((gf_timefmts)-1)) {
-        _gf_timestuff(&fmts, &zeros);
-        timefmt_last = gf_timefmt_last;
-    }
-    if (timefmt_last <= fmt) {
-        fmt = gf_timefmt_default;
+    const char **fmts, **zeros;
+    struct tm tm;
+    int s;
+
+    if (c->fmt == fmt && c->sec == sec)
+        return 0;
+    if (c->fmt == fmt && __gf_timesecs[fmt] && c->minute && c->len >= 2
+        && sec > 0 && c->sec > 0 && c->sec / 60 == sec / 60) {
+        s = sec % 60;
+        c->text[c->len - 2] = '0' + s / 10;
+        c->text[c->len - 1] = '0' + s % 10;
+        c->sec = sec;
+        return 0;
     }
 
     /*
@@ -64,23 +87,54 @@ gf_time_fmt_tv(char *dst, size_t sz_dst, struct timeval *tv, unsigned int fmt)
      * number of seconds elapsed since the Epoch, 1970-01-01 00:00:00 +0000 (UTC).
      * localtime_r thread safe function
      */
-    res = localtime_r(&tv->tv_sec, &tm);
-    if (tv->tv_sec && (res != NULL)) {
-        len = strftime(dst, sz_dst, fmts[fmt], &tm);
-        if (len == 0)
-            return dst;
-        pos += len;
-        if (tv->tv_usec >= 0) {
-            len = snprintf(dst + pos, sz_dst - pos, ".%" GF_PRI_SUSECONDS,
-                           tv->tv_usec);
-            if (len >= sz_dst - pos)
-                return dst;
-            pos += len;
-        }
-        strftime(dst + pos, sz_dst - pos, " %z", &tm);
-    } else {
+    c->fmt = (unsigned int)-1;
+    if (localtime_r(&sec, &tm) == NULL)
+        return -1;
+    _gf_timestuff(&fmts, &zeros);
+    if ((c->len = strftime(c->text, sizeof(c->text), fmts[fmt], &tm)) == 0)
+        return -1;
+    c->tzlen = strftime(c->tz, sizeof(c->tz), " %z", &tm);
+    c->minute = sec > 0 && tm.tm_sec == sec % 60;
+    c->sec = sec;
+    c->fmt = fmt;
+    return 0;
+}
+
+/*
+ * return address of value equel dst
+ */
+static inline char *
+gf_time_fmt_tv(char *dst, size_t sz_dst, struct timeval *tv, unsigned int fmt)
+{
+    struct gf_timecache *c = &__gf_timecache;
+    char *p;
+    long usec;
+    int i;
+
+    if (gf_timefmt_last <= fmt) {
+        fmt = gf_timefmt_default;
+    }
+    if (!tv->tv_sec || _gf_timecache(c, tv->tv_sec, fmt) == -1) {
         strncpy(dst, "N/A", sz_dst);
+        return dst;
+    }
+    if (c->len + 7 + c->tzlen >= sz_dst) {
+        /* too small for the whole of it, keep what fits */
+        strncpy(dst, c->text, sz_dst);
+        dst[sz_dst - 1] = '\0';
+        return dst;
     }
+
+    memcpy(dst, c->text, c->len);
+    p = dst + c->len;
+    if ((usec = tv->tv_usec) >= 0) {
+        *p++ = '.';
+        for (i = 5; i >= 0; i--, usec /= 10)
+            p[i] = '0' + usec % 10;
+        p += 6;
+    }
+    memcpy(p, c->tz, c->tzlen);
+    p[c->tzlen] = '\0';
     return dst;
 }
 
@@ -91,6 +145,25 @@ get_time_fmt(char *dst, size_t sz_dst, time_t utime, unsigned int fmt)
     return gf_time_fmt_tv(dst, sz_dst, &tv, fmt);
 }
 
+/*
+ * The coarse clock is read without a system call, it is as
+ * precise as the scheduler tick which is plenty for logs
+ */
+char *
+get_time_now(char *dst, size_t sz_dst, unsigned int fmt)
+{
+    struct timespec ts;
+    struct timeval tv;
+
+#ifdef CLOCK_REALTIME_COARSE
+    if (clock_gettime(CLOCK_REALTIME_COARSE, &ts) == -1)
+#endif
+        clock_gettime(CLOCK_REALTIME, &ts);
+    tv.tv_sec = ts.tv_sec;
+    tv.tv_usec = ts.tv_nsec / 1000;
+    return gf_time_fmt_tv(dst, sz_dst, &tv, fmt);
+}
+
 /*
  * Modify the irregular multi-level directory, 
  * for example: /b/////c////d will be modified 
@@ -242,6 +315,10 @@ readfile(const char *file) {
     if ((fp = fopen(file, "rb")) == NULL)
         goto cleanup;
 
+    /* get the length */
+    if (fseek(fp, 0, SEEK_END) != 0)
+        goto cleanup;
+
     if ((length = ftell(fp)) < 0)
         goto cleanup;
 
@@ -268,4 +345,55 @@ cleanup:
         fclose(fp);
 
     return content;
+}
+
+int
+gpt_buf_reserve(gpt_buf_t *b, size_t n) {
+    size_t  cap;
+    char   *data;
+
+    if (b->len + n + 1 <= b->cap)
+        return 0;
+
+    cap = b->cap ? b->cap : 256;
+    while (cap < b->len + n + 1)
+        cap *= 2;
+
+    if ((data = (char *)realloc(b->data, cap)) == NULL)
+        return -1;
+    b->data = data;
+    b->cap = cap;
+    return 0;
+}
+
+int
+gpt_buf_append(gpt_buf_t *b, const char *s, size_t n) {
+    if (gpt_buf_reserve(b, n) == -1)
+        return -1;
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+    b->data[b->len] = '\0';
+    return 0;
+}
+
+int
+gpt_buf_puts(gpt_buf_t *b, const char *s) {
+    return gpt_buf_append(b, s, strlen(s));
+}
+
+/*
+ * Drop the content but keep the memory for reuse
+ */
+void
+gpt_buf_reset(gpt_buf_t *b) {
+    b->len = 0;
+    if (b->data)
+        b->data[0] = '\0';
+}
+
+void
+gpt_buf_free(gpt_buf_t *b) {
+    free(b->data);
+    b->data = NULL;
+    b->len = b->cap = 0;
 }
\ No newline at end of file
@@ -20,6 +20,12 @@ typedef enum {
 } gf_timefmts;
 
 char *get_time_fmt(char *dst, size_t sz_dst, time_t utime, unsigned int fmt);
+/*
+ * The current time in fmt with microseconds, like "Apr 09 10:20:30.123456 +0800".
+ * Each thread keeps the text of the last minute it formatted, so a new
+ * second only rewrites the seconds
+ */
+char *get_time_now(char *dst, size_t sz_dst, unsigned int fmt);
 /*
  * Modify the irregular multi-level directory, 
  * for example: /b/////c////d will be modified 
@@ -49,4 +55,24 @@ int get_http_data(FILE *fp, char **data);
  */
 char *readfile(const char *file);
 
+/*
+ * Growable byte buffer, data is always NUL terminated
+ * so it can be handed to string functions directly.
+ */
+struct buf {
+    char   *data;
+    size_t  len;
+    size_t  cap;
+};
+
+/*
+ * Make sure there is room for n more bytes (plus the terminating NUL),
+ * return 0 if successful, otherwise return -1
+ */
+int gpt_buf_reserve(gpt_buf_t *b, size_t n);
+int gpt_buf_append(gpt_buf_t *b, const char *s, size_t n);
+int gpt_buf_puts(gpt_buf_t *b, const char *s);
+void gpt_buf_reset(gpt_buf_t *b);
+void gpt_buf_free(gpt_buf_t *b);
+
 #endif
\ No newline at end of file
@@ -5,13 +5,16 @@
 #define __GPT_CONFIG__
 
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <assert.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
+#include <signal.h>
 #include <math.h>
 #include <unistd.h>
 #include <pthread.h>
@@ -19,11 +22,18 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/select.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <sys/time.h>
 #include <fcntl.h>
+#include <termios.h>
 #include <getopt.h>
 #include <limits.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <gpt_linenoise.h>
 
 
@@ -36,13 +46,48 @@ typedef struct object       gpt_object_t;
 typedef struct error        gpt_error_t;
 typedef struct clog         gpt_clog_t;
 typedef struct jfile        gpt_jfile_t;
+typedef struct strview      gpt_str_t;
+typedef struct view         gpt_view_t;
 typedef struct gpt_module_s gpt_module_t;
+typedef struct buf          gpt_buf_t;
+typedef struct http_url     gpt_url_t;
+typedef struct http_conn    gpt_conn_t;
+typedef struct http_client  gpt_http_t;
+typedef struct http_pool    gpt_pool_t;
+typedef struct http_response gpt_response_t;
+typedef struct http_sse     gpt_sse_t;
+typedef struct http_call    gpt_call_t;
+typedef struct http_flight  gpt_flight_t;
+typedef struct event_loop   gpt_loop_t;
+typedef struct event_io     gpt_io_t;
+typedef struct event_timer  gpt_timer_t;
+typedef struct render       gpt_render_t;
+typedef struct arena        gpt_arena_t;
+typedef struct vocab        gpt_vocab_t;
+typedef struct turn         gpt_turn_t;
+typedef struct conv         gpt_conv_t;
+typedef struct limit        gpt_limit_t;
+typedef struct limit_wait   gpt_wait_t;
+typedef struct batch        gpt_batch_t;
+typedef struct serve        gpt_serve_t;
+typedef struct cache        gpt_cache_t;
+typedef struct console      gpt_console_t;
 
 typedef int                 gpt_int;
 
 #include <gpt_common.h>
+#include <gpt_arena.h>
 #include <gpt_json.h>
+#include <gpt_cache.h>
 #include <gpt_log.h>
+#include <gpt_event.h>
+#include <gpt_limit.h>
+#include <gpt_http.h>
+#include <gpt_render.h>
+#include <gpt_token.h>
+#include <gpt_conv.h>
+#include <gpt_batch.h>
+#include <gpt_serve.h>
 #include <gpt_module.h>
 #include <gpt_main.h>
 
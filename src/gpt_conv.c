@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ */
+#include <gpt_config.h>
+
+static gpt_turn_t *
+_gpt_conv_turn(gpt_conv_t *c, const char *role, const char *content, size_t len) {
+    gpt_turn_t *t;
+
+    if ((t = (gpt_turn_t *)malloc(sizeof(*t) + len + 1)) == NULL)
+        return NULL;
+    memset(t, 0, sizeof(*t));
+    strncpy(t->role, role, sizeof(t->role) - 1);
+    memcpy(t->content, content, len);
+    t->content[len] = '\0';
+    t->len = len;
+    t->tokens = gpt_token_count(c->vocab, content, len)
+                + gpt_token_count(c->vocab, role, strlen(role)) + GPT_TOKEN_MESSAGE;
+    return t;
+}
+
+gpt_conv_t *
+gpt_conv_create(const char *system, const gpt_vocab_t *vocab) {
+    gpt_conv_t *c;
+
+    if ((c = (gpt_conv_t *)calloc(1, sizeof(*c))) == NULL)
+        return NULL;
+    c->vocab = vocab;
+    c->tokens = GPT_TOKEN_PRIMING;
+
+    if (system != NULL && *system != '\0') {
+        c->system = _gpt_conv_turn(c, "system", system, strlen(system));
+        if (c->system == NULL
+            || gpt_json_message(&c->sysjson, "system", system, strlen(system)) == -1) {
+            gpt_conv_destroy(c);
+            return NULL;
+        }
+        c->system->size = c->sysjson.len;
+        c->tokens += c->system->tokens;
+    }
+    return c;
+}
+
+void
+gpt_conv_clear(gpt_conv_t *c) {
+    gpt_turn_t *t;
+
+    while ((t = c->head) != NULL) {
+        c->head = t->next;
+        free(t);
+    }
+    c->tail = NULL;
+    c->turns = 0;
+    c->base = 0;
+    c->tokens = GPT_TOKEN_PRIMING + (c->system ? c->system->tokens : 0);
+    gpt_buf_reset(&c->prefix);
+}
+
+void
+gpt_conv_destroy(gpt_conv_t *c) {
+    if (c == NULL)
+        return;
+    gpt_conv_clear(c);
+    free(c->system);
+    gpt_buf_free(&c->sysjson);
+    gpt_buf_free(&c->prefix);
+    free(c);
+}
+
+int
+gpt_conv_append(gpt_conv_t *c, const char *role, const char *content, size_t len) {
+    gpt_turn_t *t;
+
+    if ((t = _gpt_conv_turn(c, role, content, len)) == NULL)
+        return -1;
+
+    /* only the new message is serialized, behind the cached ones */
+    t->off = c->base + c->prefix.len;
+    if (gpt_buf_append(&c->prefix, ",", 1) == -1
+        || gpt_json_message(&c->prefix, role, content, len) == -1) {
+        c->prefix.len = t->off - c->base;
+        if (c->prefix.data != NULL)
+            c->prefix.data[c->prefix.len] = '\0';
+        free(t);
+        return -1;
+    }
+    t->size = c->base + c->prefix.len - t->off;
+
+    if (c->tail != NULL)
+        c->tail->next = t;
+    else
+        c->head = t;
+    c->tail = t;
+    c->turns++;
+    c->tokens += t->tokens;
+    return 0;
+}
+
+void
+gpt_conv_pop(gpt_conv_t *c) {
+    gpt_turn_t *t, *prev = NULL;
+
+    if (c->tail == NULL)
+        return;
+    /* the list is singly linked, popping is rare (failed requests) */
+    for (t = c->head; t != c->tail; t = t->next)
+        prev = t;
+
+    c->prefix.len = t->off - c->base;
+    c->prefix.data[c->prefix.len] = '\0';
+    c->tokens -= t->tokens;
+    if (prev != NULL) {
+        prev->next = NULL;
+    } else {
+        /* bytes of dropped turns may be left, start over behind them */
+        c->head = NULL;
+        c->base = t->off;
+        gpt_buf_reset(&c->prefix);
+    }
+    c->tail = prev;
+    c->turns--;
+    free(t);
+}
+
+/*
+ * Drop the oldest turn, its token count comes off the total
+ * so this costs nothing for the turns that are kept
+ */
+static void
+_gpt_conv_shift(gpt_conv_t *c) {
+    gpt_turn_t *t = c->head;
+    size_t      dead;
+
+    c->head = t->next;
+    c->tokens -= t->tokens;
+    c->turns--;
+    if (c->head == NULL) {
+        c->tail = NULL;
+        c->base += c->prefix.len;
+        gpt_buf_reset(&c->prefix);
+    } else if ((dead = c->head->off - c->base) > c->prefix.len / 2) {
+        memmove(c->prefix.data, c->prefix.data + dead, c->prefix.len - dead + 1);
+        c->prefix.len -= dead;
+        c->base += dead;
+    }
+    free(t);
+}
+
+int
+gpt_conv_trim(gpt_conv_t *c, size_t budget) {
+    size_t  least = GPT_TOKEN_PRIMING;
+    int     dropped = 0;
+
+    /* with only the newest turn left, if even that does not fit keep everything */
+    if (c->system != NULL)
+        least += c->system->tokens;
+    if (c->tail != NULL)
+        least += c->tail->tokens;
+    if (least > budget)
+        return -1;
+
+    while (c->tokens > budget && c->head != c->tail) {
+        _gpt_conv_shift(c);
+        dropped++;
+    }
+    /* do not start the history with an answer to a dropped prompt */
+    if (dropped > 0 && c->head != c->tail && strcmp(c->head->role, "assistant") == 0) {
+        _gpt_conv_shift(c);
+        dropped++;
+    }
+    return dropped;
+}
+
+int
+gpt_conv_data(gpt_conv_t *c, gpt_request_t *rq, gpt_buf_t *b) {
+    const char *s = c->prefix.data;
+    size_t      len = c->prefix.len;
+
+    if (gpt_json_head(rq, b) == -1)
+        return -1;
+    if (c->head != NULL) {
+        /* dropped turns may still be in front of head */
+        s += c->head->off - c->base;
+        len -= c->head->off - c->base;
+    }
+    if (c->system != NULL) {
+        if (gpt_buf_append(b, c->sysjson.data, c->sysjson.len) == -1)
+            return -1;
+    } else if (len > 0) {
+        /* no comma before the first message */
+        s++;
+        len--;
+    }
+    if (len > 0 && gpt_buf_append(b, s, len) == -1)
+        return -1;
+    return gpt_json_tail(b);
+}
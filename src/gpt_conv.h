@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ * Conversation of a session: the system, user and assistant messages
+ * that are sent as the messages array of every request.
+ */
+#ifndef __GPT_CONV__
+#define __GPT_CONV__
+
+#include <gpt_config.h>
+
+/*
+ * One message, the content is stored right behind the node
+ */
+struct turn {
+    char        role[16];
+    size_t      len;
+    size_t      off;        /* where its JSON (leading comma included) starts */
+    size_t      size;       /* length of its JSON */
+    size_t      tokens;     /* counted once, when the turn is added */
+    gpt_turn_t *next;
+    char        content[];
+};
+
+/*
+ * Turns are a singly linked list, appending never touches earlier
+ * turns. Their serialized form is cached back to back in prefix so
+ * a request only serializes the newest message. Offsets of turns
+ * count from the start of the conversation, prefix holds what is
+ * left of it from base on: dropping the oldest turns just moves
+ * base forward, the bytes are only moved once half of prefix is
+ * dead.
+ */
+struct conv {
+    gpt_turn_t        *system;     /* sent first, never dropped */
+    gpt_turn_t        *head;
+    gpt_turn_t        *tail;
+    int                turns;
+    size_t             tokens;     /* of every message sent, reply priming included */
+    size_t             base;       /* offset of prefix.data[0] */
+    const gpt_vocab_t *vocab;      /* NULL estimates the counts */
+    gpt_buf_t          sysjson;    /* serialized system message */
+    gpt_buf_t          prefix;     /* serialized turns: ,{...},{...} */
+};
+
+/*
+ * Create a conversation, system and vocab may be NULL
+ */
+gpt_conv_t *gpt_conv_create(const char *system, const gpt_vocab_t *vocab);
+void gpt_conv_destroy(gpt_conv_t *c);
+/*
+ * Add a message at the end, return 0 if successful, otherwise return -1
+ */
+int gpt_conv_append(gpt_conv_t *c, const char *role, const char *content, size_t len);
+/*
+ * Remove the newest message, e.g. a prompt whose request failed
+ */
+void gpt_conv_pop(gpt_conv_t *c);
+/*
+ * Drop the oldest turns until the request fits in budget tokens, the
+ * newest turn always stays. Return the number of turns dropped, or -1
+ * without dropping any if the newest turn alone does not fit.
+ */
+int gpt_conv_trim(gpt_conv_t *c, size_t budget);
+/*
+ * Forget every message except the system one
+ */
+void gpt_conv_clear(gpt_conv_t *c);
+/*
+ * Serialize the whole request for the conversation into b
+ */
+int gpt_conv_data(gpt_conv_t *c, gpt_request_t *rq, gpt_buf_t *b);
+
+#endif
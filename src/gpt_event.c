@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ */
+#include <gpt_config.h>
+#include <sys/epoll.h>
+
+static uint64_t
+_gpt_loop_clock(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+gpt_loop_t *
+gpt_loop_create(void) {
+    gpt_loop_t *l;
+
+    if ((l = (gpt_loop_t *)calloc(1, sizeof(*l))) == NULL)
+        return NULL;
+    if ((l->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        free(l);
+        return NULL;
+    }
+    l->now = _gpt_loop_clock();
+    return l;
+}
+
+void
+gpt_loop_destroy(gpt_loop_t *l) {
+    if (l == NULL)
+        return;
+    close(l->epfd);
+    free(l->timers);
+    free(l);
+}
+
+static uint32_t
+_gpt_loop_mask(int events) {
+    return (events & GPT_EV_READ ? EPOLLIN : 0) | (events & GPT_EV_WRITE ? EPOLLOUT : 0);
+}
+
+int
+gpt_loop_add(gpt_loop_t *l, gpt_io_t *io, int fd, int events,
+             void (*fn)(gpt_io_t *io, int events), void *arg) {
+    struct epoll_event  ev;
+
+    io->fd = fd;
+    io->events = events;
+    io->fn = fn;
+    io->arg = arg;
+    ev.events = _gpt_loop_mask(events);
+    ev.data.ptr = io;
+    if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        return -1;
+    l->ios++;
+    return 0;
+}
+
+int
+gpt_loop_mod(gpt_loop_t *l, gpt_io_t *io, int events) {
+    struct epoll_event  ev;
+
+    if (io->events == events)
+        return 0;
+    ev.events = _gpt_loop_mask(events);
+    ev.data.ptr = io;
+    if (epoll_ctl(l->epfd, EPOLL_CTL_MOD, io->fd, &ev) == -1)
+        return -1;
+    io->events = events;
+    return 0;
+}
+
+/*
+ * io may be freed right after this, events already
+ * taken for it in the current iteration are dropped
+ */
+void
+gpt_loop_del(gpt_loop_t *l, gpt_io_t *io) {
+    struct epoll_event *evs = (struct epoll_event *)l->fired;
+
+    if (io->fd == -1)
+        return;
+    if (epoll_ctl(l->epfd, EPOLL_CTL_DEL, io->fd, NULL) == 0)
+        l->ios--;
+    io->fd = -1;
+    for (int i = 0; i < l->nfired; i++) {
+        if (evs[i].data.ptr == io)
+            evs[i].data.ptr = NULL;
+    }
+}
+
+static void
+_gpt_timer_swap(gpt_loop_t *l, int i, int j) {
+    gpt_timer_t *t = l->timers[i];
+
+    l->timers[i] = l->timers[j];
+    l->timers[j] = t;
+    l->timers[i]->index = i;
+    l->timers[j]->index = j;
+}
+
+static void
+_gpt_timer_up(gpt_loop_t *l, int i) {
+    while (i > 0 && l->timers[(i - 1) / 2]->when > l->timers[i]->when) {
+        _gpt_timer_swap(l, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void
+_gpt_timer_down(gpt_loop_t *l, int i) {
+    int c;
+
+    while ((c = 2 * i + 1) < l->ntimers) {
+        if (c + 1 < l->ntimers && l->timers[c + 1]->when < l->timers[c]->when)
+            c++;
+        if (l->timers[i]->when <= l->timers[c]->when)
+            break;
+        _gpt_timer_swap(l, i, c);
+        i = c;
+    }
+}
+
+void
+gpt_timer_stop(gpt_loop_t *l, gpt_timer_t *t) {
+    int i = t->index;
+
+    if (i < 0 || i >= l->ntimers || l->timers[i] != t)
+        return;
+    t->index = -1;
+    if (i != --l->ntimers) {
+        l->timers[i] = l->timers[l->ntimers];
+        l->timers[i]->index = i;
+        _gpt_timer_down(l, i);
+        _gpt_timer_up(l, i);
+    }
+}
+
+int
+gpt_timer_start(gpt_loop_t *l, gpt_timer_t *t, long ms,
+                void (*fn)(gpt_timer_t *t), void *arg) {
+    gpt_timer_t **timers;
+
+    gpt_timer_stop(l, t);
+    /* the loop may have been idle for a while, now is refreshed */
+    l->now = _gpt_loop_clock();
+    t->fn = fn;
+    t->arg = arg;
+    t->when = l->now + (ms > 0 ? ms : 0);
+    t->index = -1;
+
+    if (l->ntimers == l->cap) {
+        timers = (gpt_timer_t **)realloc(l->timers, (l->cap ? l->cap * 2 : 16) * sizeof(*timers));
+        if (timers == NULL)
+            return -1;
+        l->timers = timers;
+        l->cap = l->cap ? l->cap * 2 : 16;
+    }
+    t->index = l->ntimers++;
+    l->timers[t->index] = t;
+    _gpt_timer_up(l, t->index);
+    return 0;
+}
+
+int
+gpt_loop_once(gpt_loop_t *l, long timeout) {
+    struct epoll_event  evs[GPT_LOOP_EVENTS];
+    gpt_timer_t        *t;
+    gpt_io_t           *io;
+    int                 n, i, events, count = 0;
+    long                wait = timeout;
+
+    /* sleep no longer than up to the first timer */
+    if (l->ntimers > 0) {
+        wait = l->timers[0]->when > l->now ? (long)(l->timers[0]->when - l->now) : 0;
+        if (timeout >= 0 && timeout < wait)
+            wait = timeout;
+    }
+
+    if ((n = epoll_wait(l->epfd, evs, GPT_LOOP_EVENTS, (int)wait)) == -1) {
+        if (errno != EINTR)
+            return -1;
+        n = 0;
+    }
+    l->now = _gpt_loop_clock();
+
+    l->fired = evs;
+    l->nfired = n;
+    for (i = 0; i < n; i++) {
+        if ((io = (gpt_io_t *)evs[i].data.ptr) == NULL)
+            continue;
+        events = (evs[i].events & EPOLLIN ? GPT_EV_READ : 0)
+               | (evs[i].events & EPOLLOUT ? GPT_EV_WRITE : 0);
+        /* errors and hangups wake whoever is waiting, the next call tells */
+        if (evs[i].events & (EPOLLERR | EPOLLHUP))
+            events |= GPT_EV_ERROR | (io->events & (GPT_EV_READ | GPT_EV_WRITE));
+        io->fn(io, events);
+        count++;
+    }
+    l->fired = NULL;
+    l->nfired = 0;
+
+    while (l->ntimers > 0 && l->timers[0]->when <= l->now) {
+        t = l->timers[0];
+        gpt_timer_stop(l, t);
+        t->fn(t);
+        count++;
+    }
+    return count;
+}
+
+int
+gpt_loop_run(gpt_loop_t *l) {
+    l->stop = 0;
+    while (!l->stop && (l->ios > 0 || l->ntimers > 0)) {
+        if (gpt_loop_once(l, -1) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+void
+gpt_loop_stop(gpt_loop_t *l) {
+    l->stop = 1;
+}
+
+uint64_t
+gpt_loop_now(gpt_loop_t *l) {
+    return l->now;
+}
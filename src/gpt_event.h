@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ * Event loop: epoll for file descriptors and a heap of timers. Every
+ * request, the terminal and the typewriter are driven from one loop.
+ */
+#ifndef __GPT_EVENT__
+#define __GPT_EVENT__
+
+#include <gpt_config.h>
+
+#define GPT_EV_READ     0x01
+#define GPT_EV_WRITE    0x02
+#define GPT_EV_ERROR    0x04    /* delivered with the events asked for */
+
+#define GPT_LOOP_EVENTS 64      /* events taken per epoll_wait */
+
+/*
+ * A watched file descriptor, embedded in its owner
+ */
+struct event_io {
+    int         fd;
+    int         events;     /* GPT_EV_READ | GPT_EV_WRITE */
+    void      (*fn)(gpt_io_t *io, int events);
+    void       *arg;
+};
+
+/*
+ * A one-shot timer, embedded in its owner
+ */
+struct event_timer {
+    uint64_t    when;       /* monotonic ms */
+    int         index;      /* position in the heap, -1 if not running */
+    void      (*fn)(gpt_timer_t *t);
+    void       *arg;
+};
+
+struct event_loop {
+    int             epfd;
+    int             ios;        /* registered descriptors */
+    int             stop;
+    uint64_t        now;        /* monotonic ms, updated once per iteration */
+    gpt_timer_t   **timers;     /* min-heap on when */
+    int             ntimers;
+    int             cap;
+    void           *fired;      /* events being dispatched (struct epoll_event) */
+    int             nfired;
+};
+
+gpt_loop_t *gpt_loop_create(void);
+void gpt_loop_destroy(gpt_loop_t *l);
+/*
+ * Watch io->fd for events, fn is called with the events that occurred.
+ * Return 0 if successful, otherwise return -1
+ */
+int gpt_loop_add(gpt_loop_t *l, gpt_io_t *io, int fd, int events,
+                 void (*fn)(gpt_io_t *io, int events), void *arg);
+int gpt_loop_mod(gpt_loop_t *l, gpt_io_t *io, int events);
+void gpt_loop_del(gpt_loop_t *l, gpt_io_t *io);
+/*
+ * (Re)start t to fire once after ms milliseconds. Return 0 if
+ * successful, otherwise return -1 and t is not armed
+ */
+int gpt_timer_start(gpt_loop_t *l, gpt_timer_t *t, long ms,
+                     void (*fn)(gpt_timer_t *t), void *arg);
+void gpt_timer_stop(gpt_loop_t *l, gpt_timer_t *t);
+/*
+ * Wait for events at most timeout ms (-1 until the next one) and
+ * dispatch them, return the number dispatched or -1 on error
+ */
+int gpt_loop_once(gpt_loop_t *l, long timeout);
+/*
+ * Dispatch until gpt_loop_stop is called or nothing is left to wait for
+ */
+int gpt_loop_run(gpt_loop_t *l);
+void gpt_loop_stop(gpt_loop_t *l);
+uint64_t gpt_loop_now(gpt_loop_t *l);
+
+#endif
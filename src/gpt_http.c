@@ -0,0 +1,1609 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ */
+#include <gpt_config.h>
+#include <sys/un.h>
+#ifdef __GPTSSL__
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+static void _gpt_http_response_reset(gpt_response_t *rsp);
+static int _gpt_http_body(gpt_response_t *rsp, const char *data, size_t len);
+
+enum {
+    HTTP_HEAD,              /* status line and headers */
+    HTTP_BODY,              /* Content-Length body */
+    HTTP_BODY_EOF,          /* body delimited by connection close */
+    HTTP_CHUNK_SIZE,
+    HTTP_CHUNK_DATA,
+    HTTP_CHUNK_END,         /* CRLF after chunk data */
+    HTTP_TRAILER,
+    HTTP_DONE
+};
+
+/*
+ * States of a call, in the order they are passed
+ */
+enum {
+    CALL_IDLE,
+    CALL_CONNECT,
+    CALL_TUNNEL_SEND,       /* CONNECT request to the proxy */
+    CALL_TUNNEL_RECV,
+    CALL_HANDSHAKE,
+    CALL_SEND,
+    CALL_RECV,
+    CALL_DONE
+};
+
+/*
+ * Copy src to dst without surrounding blanks and quotes,
+ * "\"https://api.openai.com\"" becomes https://api.openai.com
+ */
+static void
+_gpt_http_unquote(char *dst, size_t size, const char *src) {
+    size_t len;
+
+    while (*src == ' ' || *src == '"' || *src == '\'')
+        src++;
+    len = strlen(src);
+    while (len > 0 && (src[len - 1] == ' ' || src[len - 1] == '"'
+                        || src[len - 1] == '\'' || src[len - 1] == '\n'))
+        len--;
+    if (len >= size)
+        len = size - 1;
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+int
+gpt_http_url(gpt_url_t *u, const char *s, int proxy) {
+    char    buf[1536];
+    char   *p, *host, *path, *port;
+
+    memset(u, 0, sizeof(*u));
+    _gpt_http_unquote(buf, sizeof(buf), s);
+
+    p = buf;
+    if (!proxy && strncasecmp(p, "unix:", 5) == 0) {
+        /* the socket of cgpt --serve, it serves a single path */
+        if (p[5] == '\0' || strlen(p + 5) >= sizeof(u->sock))
+            return -1;
+        strcpy(u->sock, p + 5);
+        strcpy(u->host, "localhost");
+        strcpy(u->port, "80");
+        strcpy(u->path, GPT_SERVE_PATH);
+        return 0;
+    }
+    if (strncasecmp(p, "https://", 8) == 0) {
+        u->tls = 1;
+        p += 8;
+    } else if (strncasecmp(p, "http://", 7) == 0) {
+        p += 7;
+    } else if (strstr(p, "://") != NULL || !proxy) {
+        /* socks proxies and friends are left to curl */
+        return -1;
+    }
+
+    if ((path = strchr(p, '/')) != NULL) {
+        strncpy(u->path, path, sizeof(u->path) - 1);
+        *path = '\0';
+    } else {
+        strcpy(u->path, "/");
+    }
+
+    /*
+     * curl style "user:pass@host", only an empty user
+     * (e.g. "@127.0.0.1:9666") can be handled here
+     */
+    if ((host = strrchr(p, '@')) != NULL) {
+        if (host != p)
+            return -1;
+        p = host + 1;
+    }
+
+    if (*p == '[') {
+        host = p + 1;
+        if ((p = strchr(host, ']')) == NULL)
+            return -1;
+        *p++ = '\0';
+        port = (*p == ':') ? p + 1 : NULL;
+    } else {
+        host = p;
+        if ((port = strchr(p, ':')) != NULL)
+            *port++ = '\0';
+    }
+
+    if (*host == '\0' || strlen(host) >= sizeof(u->host))
+        return -1;
+    strcpy(u->host, host);
+    if (port && *port) {
+        strncpy(u->port, port, sizeof(u->port) - 1);
+    } else {
+        strcpy(u->port, u->tls ? "443" : "80");
+    }
+    return 0;
+}
+
+gpt_http_t *
+gpt_http_create(const char *url, const char *proxy, long timeout) {
+    gpt_http_t *http;
+    char        tmp[8];
+
+    if (url == NULL)
+        return NULL;
+    if ((http = (gpt_http_t *)calloc(1, sizeof(*http))) == NULL)
+        return NULL;
+    http->timeout = timeout;
+
+    if (gpt_http_url(&http->url, url, 0) == -1)
+        goto err;
+
+    /* a local socket is never reached through a proxy */
+    if (proxy != NULL && http->url.sock[0] == '\0') {
+        _gpt_http_unquote(tmp, sizeof(tmp), proxy);
+        if (tmp[0] != '\0') {
+            if (gpt_http_url(&http->proxy, proxy, 1) == -1 || http->proxy.tls)
+                goto err;
+            http->has_proxy = 1;
+        }
+    }
+
+    if (http->url.tls) {
+#ifdef __GPTSSL__
+        SSL_CTX *ctx;
+
+        if ((ctx = SSL_CTX_new(TLS_client_method())) == NULL)
+            goto err;
+        SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+        SSL_CTX_set_default_verify_paths(ctx);
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+        http->ctx = ctx;
+#else
+        goto err;
+#endif
+    }
+    return http;
+err:
+    gpt_http_destroy(http);
+    return NULL;
+}
+
+int
+gpt_http_header(gpt_http_t *http, const char *line) {
+    char    buf[1024];
+
+    _gpt_http_unquote(buf, sizeof(buf), line);
+    if (buf[0] == '\0')
+        return 0;
+    if (gpt_buf_puts(&http->headers, buf) == -1
+        || gpt_buf_append(&http->headers, "\r\n", 2) == -1)
+        return -1;
+    return 0;
+}
+
+void
+gpt_http_destroy(gpt_http_t *http) {
+    if (http == NULL)
+        return;
+#ifdef __GPTSSL__
+    if (http->ctx)
+        SSL_CTX_free((SSL_CTX *)http->ctx);
+#endif
+    gpt_buf_free(&http->headers);
+    free(http);
+}
+
+/*
+ * Non-blocking read, return the bytes read, 0 at EOF, otherwise -1;
+ * errno EAGAIN means wait for *want (GPT_EV_READ or GPT_EV_WRITE)
+ */
+static ssize_t
+_gpt_http_read(gpt_conn_t *c, char *buf, size_t n, int *want) {
+    ssize_t rc;
+
+    *want = GPT_EV_READ;
+#ifdef __GPTSSL__
+    if (c->ssl) {
+        int ret = SSL_read((SSL *)c->ssl, buf, (int)n);
+        if (ret > 0)
+            return ret;
+        switch (SSL_get_error((SSL *)c->ssl, ret)) {
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;
+        case SSL_ERROR_WANT_WRITE:
+            *want = GPT_EV_WRITE;
+            /* fall through */
+        case SSL_ERROR_WANT_READ:
+            errno = EAGAIN;
+            return -1;
+        default:
+            /* servers often skip close_notify, treat it as EOF */
+            return ERR_peek_error() == 0 ? 0 : -1;
+        }
+    }
+#endif
+    do {
+        rc = read(c->fd, buf, n);
+    } while (rc == -1 && errno == EINTR);
+    return rc;
+}
+
+/*
+ * Non-blocking write, return the bytes written, otherwise -1;
+ * errno EAGAIN means wait for *want
+ */
+static ssize_t
+_gpt_http_write(gpt_conn_t *c, const char *buf, size_t n, int *want) {
+    ssize_t rc;
+
+    *want = GPT_EV_WRITE;
+#ifdef __GPTSSL__
+    if (c->ssl) {
+        int ret = SSL_write((SSL *)c->ssl, buf, (int)n);
+        if (ret > 0)
+            return ret;
+        switch (SSL_get_error((SSL *)c->ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+            *want = GPT_EV_READ;
+            /* fall through */
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        default:
+            return -1;
+        }
+    }
+#endif
+    do {
+        rc = send(c->fd, buf, n, MSG_NOSIGNAL);
+    } while (rc == -1 && errno == EINTR);
+    return rc;
+}
+
+static void
+_gpt_http_close(gpt_conn_t *c) {
+#ifdef __GPTSSL__
+    if (c->ssl) {
+        SSL_free((SSL *)c->ssl);
+        c->ssl = NULL;
+    }
+#endif
+    if (c->fd != -1) {
+        close(c->fd);
+        c->fd = -1;
+    }
+}
+
+gpt_pool_t *
+gpt_pool_create(int max, long idle) {
+    gpt_pool_t *pool;
+
+    if ((pool = (gpt_pool_t *)calloc(1, sizeof(*pool))) == NULL)
+        return NULL;
+    pool->max = max > 0 ? max : 1;
+    pool->idle = idle;
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void
+gpt_pool_destroy(gpt_pool_t *pool) {
+    struct http_route  *r;
+    gpt_conn_t         *c;
+
+    if (pool == NULL)
+        return;
+    while ((r = pool->routes) != NULL) {
+        pool->routes = r->next;
+        while ((c = r->idle) != NULL) {
+            r->idle = c->next;
+            _gpt_http_close(c);
+            free(c);
+        }
+        free(r->key);
+        free(r);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+/*
+ * Routes are keyed by proxy and the scheme://host:port of the url,
+ * the path does not matter for reuse.
+ */
+int
+gpt_http_pool(gpt_http_t *http, gpt_pool_t *pool) {
+    struct http_route  *r;
+    char                key[640];
+
+    if (http->url.sock[0] != '\0')
+        snprintf(key, sizeof(key), "unix:%s", http->url.sock);
+    else
+        snprintf(key, sizeof(key), "%s:%s|%s://%s:%s",
+                http->has_proxy ? http->proxy.host : "",
+                http->has_proxy ? http->proxy.port : "",
+                http->url.tls ? "https" : "http", http->url.host, http->url.port);
+
+    pthread_mutex_lock(&pool->lock);
+    for (r = pool->routes; r != NULL; r = r->next) {
+        if (strcmp(r->key, key) == 0)
+            break;
+    }
+    if (r == NULL) {
+        if ((r = (struct http_route *)calloc(1, sizeof(*r))) == NULL
+            || (r->key = strdup(key)) == NULL) {
+            pthread_mutex_unlock(&pool->lock);
+            free(r);
+            return -1;
+        }
+        r->next = pool->routes;
+        pool->routes = r;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    http->pool = pool;
+    http->route = r;
+    return 0;
+}
+
+/*
+ * An idle connection must have nothing to read: readable means
+ * the peer closed it (or sent garbage), both make it useless.
+ * TLS records that carry no application data (session tickets)
+ * are consumed by SSL_peek on the non-blocking socket.
+ */
+static int
+_gpt_http_alive(gpt_conn_t *c) {
+    struct pollfd   pfd;
+    char            ch;
+
+    pfd.fd = c->fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 0) == 0)
+        return 1;
+    if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+        return 0;
+#ifdef __GPTSSL__
+    if (c->ssl) {
+        int ret = SSL_peek((SSL *)c->ssl, &ch, 1);
+        return ret <= 0 && SSL_get_error((SSL *)c->ssl, ret) == SSL_ERROR_WANT_READ;
+    }
+#endif
+    (void)ch;
+    return 0;
+}
+
+/*
+ * Take a healthy idle connection of the route into *c and return 1,
+ * or return 0 after taking the slot of a new connection (opened by
+ * the caller), always the latter when fresh is set. Expired and dead
+ * connections found on the way are closed. Return -1 (errno EAGAIN)
+ * when the route is at max.
+ */
+static int
+_gpt_http_acquire(gpt_http_t *http, gpt_conn_t **c, int fresh) {
+    struct http_route  *r = http->route;
+    time_t              now = time(NULL);
+
+    *c = NULL;
+    if (http->pool == NULL)
+        return 0;
+
+    pthread_mutex_lock(&http->pool->lock);
+    while (!fresh && (*c = r->idle) != NULL) {
+        r->idle = (*c)->next;
+        r->nidle--;
+        if (now - (*c)->used < http->pool->idle && _gpt_http_alive(*c)) {
+            r->active++;
+            pthread_mutex_unlock(&http->pool->lock);
+            return 1;
+        }
+        _gpt_http_close(*c);
+        free(*c);
+    }
+
+    if (r->active >= http->pool->max) {
+        pthread_mutex_unlock(&http->pool->lock);
+        errno = EAGAIN;
+        return -1;
+    }
+    r->active++;
+    pthread_mutex_unlock(&http->pool->lock);
+    return 0;
+}
+
+/*
+ * Hand the connection (NULL for a slot whose connection never opened)
+ * back, it is kept only if the last response allows it and the route
+ * has room for another idle connection.
+ */
+static void
+_gpt_http_release(gpt_http_t *http, gpt_conn_t *c, int reuse) {
+    struct http_route *r = http->route;
+
+    if (http->pool != NULL) {
+        pthread_mutex_lock(&http->pool->lock);
+        r->active--;
+        if (c != NULL && reuse && http->pool->idle > 0
+            && r->nidle + r->active < http->pool->max) {
+            c->used = time(NULL);
+            c->served++;
+            c->next = r->idle;
+            r->idle = c;
+            r->nidle++;
+            pthread_mutex_unlock(&http->pool->lock);
+            return;
+        }
+        pthread_mutex_unlock(&http->pool->lock);
+    }
+    if (c != NULL) {
+        _gpt_http_close(c);
+        free(c);
+    }
+}
+
+/*
+ * Build the request head, a plain http request through
+ * a proxy uses the absolute url as request target.
+ */
+static void
+_gpt_http_head(gpt_http_t *http, gpt_buf_t *b, size_t len) {
+    char    line[1536];
+    char    host[300];
+
+    if (http->has_proxy && !http->url.tls) {
+        snprintf(line, sizeof(line), "POST http://%s:%s%s HTTP/1.1\r\n",
+                http->url.host, http->url.port, http->url.path);
+    } else {
+        snprintf(line, sizeof(line), "POST %s HTTP/1.1\r\n", http->url.path);
+    }
+    gpt_buf_puts(b, line);
+
+    /* the port is part of Host only when it is not the default one */
+    if (strcmp(http->url.port, http->url.tls ? "443" : "80") == 0)
+        snprintf(host, sizeof(host), "%s", http->url.host);
+    else
+        snprintf(host, sizeof(host), "%s:%s", http->url.host, http->url.port);
+
+    snprintf(line, sizeof(line),
+            "Host: %s\r\n"
+            "User-Agent: cgpt/" GPT_VERSION "\r\n"
+            "Accept: */*\r\n"
+            "Connection: %s\r\n"
+            "Content-Length: %zu\r\n", host,
+            http->pool && http->pool->idle > 0 ? "keep-alive" : "close", len);
+    gpt_buf_puts(b, line);
+    gpt_buf_append(b, http->headers.data ? http->headers.data : "", http->headers.len);
+    gpt_buf_append(b, "\r\n", 2);
+}
+
+gpt_call_t *
+gpt_call_create(gpt_loop_t *loop, void (*done)(gpt_call_t *call), void *arg) {
+    gpt_call_t *call;
+
+    if ((call = (gpt_call_t *)calloc(1, sizeof(*call))) == NULL)
+        return NULL;
+    call->loop = loop;
+    call->done = done;
+    call->arg = arg;
+    call->io.fd = -1;
+    call->pipe = -1;
+    call->timer.index = -1;
+    call->state = CALL_IDLE;
+    call->retries = GPT_RETRY_MAX;
+    gpt_http_response_init(&call->rsp);
+    return call;
+}
+
+/*
+ * Let go of the connection and everything watched, the
+ * connection goes back to the pool only when reuse is set
+ */
+static void
+_gpt_call_detach(gpt_call_t *call, int reuse) {
+    int status;
+
+    gpt_loop_del(call->loop, &call->io);
+    gpt_timer_stop(call->loop, &call->timer);
+    if (call->addrs != NULL) {
+        freeaddrinfo(call->addrs);
+        call->addrs = NULL;
+    }
+    if (call->http != NULL && call->state != CALL_IDLE && call->state != CALL_DONE)
+        _gpt_http_release(call->http, call->conn, reuse);
+    call->conn = NULL;
+    if (call->pipe != -1) {
+        close(call->pipe);
+        call->pipe = -1;
+    }
+    if (call->child > 0) {
+        /* curl is done once its output ends, otherwise it is stopped */
+        if (waitpid(call->child, &status, WNOHANG) == 0) {
+            kill(-call->child, SIGTERM);
+            waitpid(call->child, &status, 0);
+        } else if (!WIFEXITED(status)) {
+            printf("(clog): Exited abnormally.\n");
+        }
+        call->child = 0;
+    }
+}
+
+/*
+ * Whether a failed request can not have reached the server, only
+ * then is it safe to send again: it did not go out in full, or a
+ * kept connection was closed before any byte of the reply. A curl
+ * child tells neither.
+ */
+static int
+_gpt_call_unsent(gpt_call_t *call) {
+    if (call->http == NULL)
+        return 0;
+    return call->state < CALL_RECV || call->dropped;
+}
+
+/*
+ * Whether the outcome is worth another attempt: rate limits and
+ * server errors, or a request the server never got. Quota errors
+ * and anything already passed on to on_body are final.
+ */
+static int
+_gpt_call_transient(gpt_call_t *call, int rc) {
+    gpt_response_t *rsp = &call->rsp;
+    cJSON          *root, *error, *code, *type;
+    int             transient = 0;
+
+    if (rsp->status != 0 && !rsp->held)
+        return 0;
+    /* without a reply the completion may have run, it is billed once */
+    if (rsp->status == 0 && rsp->body.len == 0)
+        return rc == -1 && _gpt_call_unsent(call);
+    if (rsp->status != 0 && rsp->status != 429 && rsp->status < 500)
+        return 0;
+
+    /* the error object tells a rate limit from an exhausted quota */
+    root = cJSON_ParseWithLength(rsp->body.data, rsp->body.len);
+    error = cJSON_GetObjectItem(root, "error");
+    code = cJSON_GetObjectItem(error, "code");
+    type = cJSON_GetObjectItem(error, "type");
+    if (cJSON_IsString(code) && strcmp(code->valuestring, "insufficient_quota") == 0)
+        transient = 0;
+    else if (rsp->status != 0)
+        transient = 1;
+    else
+        transient = (cJSON_IsString(code) && strcmp(code->valuestring, "rate_limit_exceeded") == 0)
+                 || (cJSON_IsString(type) && strcmp(type->valuestring, "server_error") == 0);
+    cJSON_Delete(root);
+    return transient;
+}
+
+static void _gpt_call_finish(gpt_call_t *call, int rc);
+
+static void
+_gpt_call_resend(gpt_call_t *call) {
+    int rc;
+
+    call->fresh = 0;
+    if (call->http != NULL)
+        rc = gpt_call_http(call, call->http, NULL, 0);
+    else
+        rc = gpt_call_exec(call, call->cmd);
+    if (rc == -1)
+        _gpt_call_finish(call, -1);
+}
+
+static void
+_gpt_call_admit(gpt_wait_t *w) {
+    gpt_call_t *call = (gpt_call_t *)w->arg;
+
+    call->waiting = 0;
+    _gpt_call_resend(call);
+}
+
+/*
+ * A retry is one more request against the quota: it waits for the
+ * rate limit like the first attempt, whose tokens come back since
+ * a failed request used none
+ */
+static void
+_gpt_call_again(gpt_timer_t *t) {
+    gpt_call_t *call = (gpt_call_t *)t->arg;
+
+    if (call->limit != NULL) {
+        gpt_limit_settle(call->limit, call->cost, 0, 0);
+        if (gpt_limit_acquire(call->limit, &call->wait, call->cost, _gpt_call_admit, call) == 1) {
+            call->waiting = 1;
+            return;
+        }
+    }
+    _gpt_call_resend(call);
+}
+
+/*
+ * Schedule the next attempt of a transient failure on the loop,
+ * return -1 if the outcome stands
+ */
+static int
+_gpt_call_backoff(gpt_call_t *call, int rc) {
+    static unsigned int seed;
+    long                delay;
+
+    if (call->attempts >= call->retries || !_gpt_call_transient(call, rc))
+        return -1;
+    if (seed == 0)
+        seed = (unsigned int)time(NULL) ^ (unsigned int)getpid();
+
+    /* equal jitter: at least half the backoff, so retries still spread out */
+    delay = GPT_RETRY_BASE << (call->attempts < 16 ? call->attempts : 16);
+    if (delay > GPT_RETRY_CAP)
+        delay = GPT_RETRY_CAP;
+    delay = delay / 2 + rand_r(&seed) % (delay / 2 + 1);
+    /* the server knows best, a little jitter keeps batch jobs apart */
+    if (call->rsp.retry_after >= 0)
+        delay = call->rsp.retry_after + rand_r(&seed) % (GPT_RETRY_BASE / 5 + 1);
+
+    _gpt_call_detach(call, rc == 0 && call->rsp.keepalive);
+    call->state = CALL_IDLE;
+    call->attempts++;
+    _gpt_http_response_reset(&call->rsp);
+    if (gpt_timer_start(call->loop, &call->timer, delay, _gpt_call_again, call) == -1) {
+        /* the retry would never run, the call ends here */
+        call->attempts = call->retries;
+        _gpt_call_finish(call, -1);
+    }
+    return 0;
+}
+
+/*
+ * Whether a complete reply is an error object instead of a
+ * completion, curl leaves the status unknown
+ */
+static int
+_gpt_call_error(gpt_call_t *call) {
+    gpt_response_t *rsp = &call->rsp;
+    cJSON          *root;
+    int             error;
+
+    if (rsp->held || rsp->body.len == 0)
+        return 1;
+    if (rsp->status != 0)
+        return rsp->status < 200 || rsp->status >= 300;
+    if (rsp->body.data[0] != '{')
+        return 0;
+    root = cJSON_ParseWithLength(rsp->body.data, rsp->body.len);
+    error = root == NULL || cJSON_GetObjectItem(root, "error") != NULL;
+    cJSON_Delete(root);
+    return error;
+}
+
+/*
+ * Deliver a reply the call did not receive itself (rsp and rc
+ * are filled in), on_body gets it in one piece
+ */
+static void
+_gpt_call_replay(gpt_timer_t *t) {
+    gpt_call_t     *call = (gpt_call_t *)t->arg;
+    gpt_response_t *rsp = &call->rsp;
+
+    if (rsp->on_body != NULL && !rsp->held && rsp->body.len > 0) {
+        rsp->on_body(rsp, rsp->body.data, rsp->body.len);
+        if (!rsp->keep)
+            gpt_buf_reset(&rsp->body);
+    }
+    call->state = CALL_DONE;
+    if (call->done != NULL)
+        call->done(call);
+}
+
+/*
+ * Leave the flight, or the call this one waits for
+ */
+static void
+_gpt_call_leave(gpt_call_t *call) {
+    gpt_call_t **pp, *leader = call->leader;
+
+    if (leader != NULL) {
+        for (pp = &leader->followers; *pp != NULL; pp = &(*pp)->next) {
+            if (*pp == call) {
+                *pp = call->next;
+                break;
+            }
+        }
+        call->leader = NULL;
+        /* nobody is left waiting for it */
+        if (leader->orphan && leader->followers == NULL)
+            gpt_call_free(leader);
+    } else if (call->flight != NULL) {
+        for (pp = &call->flight->head; *pp != NULL; pp = &(*pp)->next) {
+            if (*pp == call) {
+                *pp = call->next;
+                break;
+            }
+        }
+    }
+    call->flight = NULL;
+    call->next = NULL;
+}
+
+/*
+ * Hand the outcome to every call that joined this one
+ */
+static void
+_gpt_call_land(gpt_call_t *call) {
+    gpt_call_t *f;
+
+    _gpt_call_leave(call);
+    while ((f = call->followers) != NULL) {
+        call->followers = f->next;
+        f->leader = NULL;
+        f->next = NULL;
+        f->rsp.status = call->rsp.status;
+        f->rsp.held = call->rsp.held;
+        gpt_buf_append(&f->rsp.body, call->rsp.body.data, call->rsp.body.len);
+        f->rc = call->rc;
+        f->state = CALL_RECV;
+        /* without the timer it gets the reply right away */
+        if (gpt_timer_start(f->loop, &f->timer, 0, _gpt_call_replay, f) == -1)
+            _gpt_call_replay(&f->timer);
+    }
+}
+
+/*
+ * The call is over, done may free it
+ */
+static void
+_gpt_call_finish(gpt_call_t *call, int rc) {
+    if (_gpt_call_backoff(call, rc) == 0)
+        return;
+    if (rc == 0 && call->cache != NULL && !_gpt_call_error(call))
+        gpt_cache_put(call->cache, call->key, call->rsp.body.data, call->rsp.body.len);
+    _gpt_call_detach(call, rc == 0 && call->rsp.keepalive);
+    call->state = CALL_DONE;
+    call->rc = rc;
+    _gpt_call_land(call);
+    if (call->orphan)
+        gpt_call_free(call);
+    else if (call->done != NULL)
+        call->done(call);
+}
+
+int
+gpt_call_cache(gpt_call_t *call, gpt_cache_t *cache, const char *body, size_t len) {
+    if (!call->keyed) {
+        gpt_cache_key(body, len, call->key);
+        call->keyed = 1;
+    }
+    if (gpt_cache_get(cache, call->key, &call->rsp.body) == -1) {
+        gpt_buf_reset(&call->rsp.body);
+        call->cache = cache;
+        return 0;
+    }
+    /* no network at all, the reply comes from the loop like any other */
+    if (gpt_timer_start(call->loop, &call->timer, 0, _gpt_call_replay, call) == -1) {
+        gpt_buf_reset(&call->rsp.body);
+        call->cache = cache;
+        return 0;
+    }
+    call->rsp.status = 200;
+    call->rc = 0;
+    call->replayed = 1;
+    call->state = CALL_RECV;
+    return 1;
+}
+
+int
+gpt_call_join(gpt_call_t *call, gpt_flight_t *flight, const char *body, size_t len) {
+    gpt_call_t *l;
+
+    if (!call->keyed) {
+        gpt_cache_key(body, len, call->key);
+        call->keyed = 1;
+    }
+    for (l = flight->head; l != NULL; l = l->next) {
+        if (memcmp(l->key, call->key, GPT_CACHE_KEY) == 0)
+            break;
+    }
+    if (l != NULL) {
+        call->leader = l;
+        call->next = l->followers;
+        l->followers = call;
+        call->replayed = 1;
+        flight->joined++;
+        return 1;
+    }
+    call->flight = flight;
+    call->next = flight->head;
+    flight->head = call;
+    /* whoever joins gets the whole body */
+    call->rsp.keep = 1;
+    return 0;
+}
+
+int
+gpt_flight_has(gpt_flight_t *flight, const char *body, size_t len) {
+    uint8_t     key[GPT_CACHE_KEY];
+    gpt_call_t *l;
+
+    if (flight->head == NULL)
+        return 0;
+    gpt_cache_key(body, len, key);
+    for (l = flight->head; l != NULL; l = l->next) {
+        if (memcmp(l->key, key, GPT_CACHE_KEY) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+void
+gpt_call_free(gpt_call_t *call) {
+    if (call == NULL)
+        return;
+    /* the owner is gone, the request runs on for the calls that joined it */
+    if (call->followers != NULL && call->state != CALL_DONE) {
+        call->orphan = 1;
+        call->done = NULL;
+        call->rsp.on_body = NULL;
+        return;
+    }
+    _gpt_call_leave(call);
+    if (call->waiting)
+        gpt_limit_cancel(call->limit, &call->wait);
+    /* a call still running is abandoned, its connection is not reused */
+    _gpt_call_detach(call, 0);
+    gpt_buf_free(&call->req);
+    gpt_buf_free(&call->tunnel);
+    gpt_http_response_free(&call->rsp);
+    free(call->cmd);
+    free(call);
+}
+
+static void _gpt_call_ready(gpt_io_t *io, int events);
+static void _gpt_call_step(gpt_call_t *call);
+
+static void
+_gpt_call_expired(gpt_timer_t *t) {
+    gpt_call_t *call = (gpt_call_t *)t->arg;
+
+    errno = ETIMEDOUT;
+    if (call->state < CALL_SEND) {
+        const gpt_url_t *to = call->http->has_proxy ? &call->http->proxy : &call->http->url;
+        printf("(cgpt): connect %s:%s %s\n", to->host, to->port, strerror(errno));
+    } else {
+        printf("(cgpt): incomplete response from %s: %s\n",
+                call->http ? call->http->url.host : "curl", strerror(errno));
+    }
+    _gpt_call_finish(call, -1);
+}
+
+/*
+ * Wait for events on fd, the descriptor is registered on first use
+ */
+static int
+_gpt_call_wait(gpt_call_t *call, int fd, int events) {
+    if (call->io.fd == -1)
+        return gpt_loop_add(call->loop, &call->io, fd, events, _gpt_call_ready, call);
+    return gpt_loop_mod(call->loop, &call->io, events);
+}
+
+/*
+ * Begin a non-blocking connect to the next address, the
+ * connect deadline (opt.timeout) covers every address
+ */
+static int
+_gpt_call_connect(gpt_call_t *call) {
+    struct addrinfo *ai;
+    int              fd, one = 1;
+
+    for (; (ai = call->ai) != NULL; call->ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    ai->ai_protocol);
+        if (fd == -1)
+            continue;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0 || errno == EINPROGRESS) {
+            call->conn->fd = fd;
+            return _gpt_call_wait(call, fd, GPT_EV_WRITE);
+        }
+        close(fd);
+    }
+    return -1;
+}
+
+/*
+ * Begin a non-blocking connect to the unix socket of the url
+ */
+static int
+_gpt_call_local(gpt_call_t *call) {
+    struct sockaddr_un  sun;
+    int                 fd;
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, call->http->url.sock);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    call->conn->fd = fd;
+    return _gpt_call_wait(call, fd, GPT_EV_WRITE);
+}
+
+/*
+ * Ask the proxy for a tunnel to host:port, used before TLS
+ */
+static void
+_gpt_call_tunnel(gpt_call_t *call) {
+    gpt_http_t *http = call->http;
+    char        req[768];
+
+    snprintf(req, sizeof(req),
+            "CONNECT %s:%s HTTP/1.1\r\nHost: %s:%s\r\n\r\n",
+            http->url.host, http->url.port, http->url.host, http->url.port);
+    gpt_buf_reset(&call->tunnel);
+    gpt_buf_puts(&call->tunnel, req);
+    call->sent = 0;
+    call->state = CALL_TUNNEL_SEND;
+}
+
+/*
+ * The connection is up to the server (tunnel and TLS included),
+ * the request goes out next
+ */
+static int
+_gpt_call_connected(gpt_call_t *call) {
+    gpt_http_t *http = call->http;
+
+    if (call->state == CALL_CONNECT && http->url.tls && http->has_proxy) {
+        _gpt_call_tunnel(call);
+        return 0;
+    }
+#ifdef __GPTSSL__
+    if (call->state < CALL_HANDSHAKE && http->url.tls) {
+        SSL *ssl;
+
+        if ((ssl = SSL_new((SSL_CTX *)http->ctx)) == NULL)
+            return -1;
+        call->conn->ssl = ssl;
+        SSL_set_fd(ssl, call->conn->fd);
+        SSL_set_tlsext_host_name(ssl, http->url.host);
+        SSL_set1_host(ssl, http->url.host);
+        call->state = CALL_HANDSHAKE;
+        return 0;
+    }
+#endif
+    /* request I/O is limited by inactivity, not by the connect deadline */
+    if (gpt_timer_start(call->loop, &call->timer, GPT_HTTP_IO_TIMEOUT * 1000L,
+                        _gpt_call_expired, call) == -1)
+        return -1;
+    call->sent = 0;
+    call->state = CALL_SEND;
+    return 0;
+}
+
+/*
+ * A request that died on a kept connection before any byte of the
+ * response is repeated once on a fresh connection, the server may
+ * close idle connections at any time. The other idle connections
+ * may be just as stale, the new one is dialed.
+ */
+static int
+_gpt_call_retry(gpt_call_t *call) {
+    gpt_response_t *rsp = &call->rsp;
+
+    if (!call->reused || call->fresh || call->state < CALL_SEND
+        || rsp->status != 0 || rsp->line.len != 0)
+        return -1;
+    call->fresh = 1;
+    gpt_loop_del(call->loop, &call->io);
+    _gpt_http_release(call->http, call->conn, 0);
+    call->conn = NULL;
+    call->state = CALL_IDLE;
+    _gpt_http_response_reset(rsp);
+    return gpt_call_http(call, call->http, NULL, 0);
+}
+
+/*
+ * Run the state machine as far as it gets without blocking
+ */
+static void
+_gpt_call_step(gpt_call_t *call) {
+    gpt_http_t     *http = call->http;
+    gpt_conn_t     *c = call->conn;
+    char            buf[GPT_MAXBUF], *end;
+    ssize_t         n;
+    size_t          from;
+    int             want = 0, err, rc;
+    socklen_t       len;
+
+    while (call->state != CALL_DONE) {
+        switch (call->state) {
+        case CALL_CONNECT:
+            len = sizeof(err);
+            if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0) {
+                /* this address failed, try the next one */
+                gpt_loop_del(call->loop, &call->io);
+                _gpt_http_close(c);
+                call->ai = call->ai != NULL ? call->ai->ai_next : NULL;
+                if (_gpt_call_connect(call) == -1) {
+                    const gpt_url_t *to = http->has_proxy ? &http->proxy : &http->url;
+                    errno = err ? err : errno;
+                    printf("(cgpt): connect %s:%s %s\n", to->host, to->port, strerror(errno));
+                    _gpt_call_finish(call, -1);
+                }
+                return;
+            }
+            freeaddrinfo(call->addrs);
+            call->addrs = NULL;
+            if (_gpt_call_connected(call) == -1)
+                goto fail;
+            break;
+
+        case CALL_TUNNEL_SEND:
+            n = _gpt_http_write(c, call->tunnel.data + call->sent,
+                                call->tunnel.len - call->sent, &want);
+            if (n == -1)
+                goto wait;
+            if ((call->sent += n) == call->tunnel.len) {
+                gpt_buf_reset(&call->tunnel);
+                call->state = CALL_TUNNEL_RECV;
+            }
+            break;
+
+        case CALL_TUNNEL_RECV:
+            /* the reply to CONNECT has no body, it ends at the blank line */
+            if ((n = _gpt_http_read(c, buf, sizeof(buf), &want)) == -1)
+                goto wait;
+            if (n == 0)
+                goto fail;
+            from = call->tunnel.len > 3 ? call->tunnel.len - 3 : 0;
+            if (gpt_buf_append(&call->tunnel, buf, n) == -1)
+                goto fail;
+            if ((end = strstr(call->tunnel.data + from, "\r\n\r\n")) == NULL) {
+                if (call->tunnel.len >= 1024)
+                    goto fail;
+                break;
+            }
+            if (sscanf(call->tunnel.data, "HTTP/%*d.%*d %d", &rc) != 1 || rc != 200) {
+                printf("(cgpt): proxy CONNECT failed: %.*s\n",
+                        (int)strcspn(call->tunnel.data, "\r\n"), call->tunnel.data);
+                _gpt_call_finish(call, -1);
+                return;
+            }
+            /* bytes after the reply are the server's, kept for the next stage */
+            end += 4;
+            n = call->tunnel.data + call->tunnel.len - end;
+            memmove(call->tunnel.data, end, n);
+            call->tunnel.len = n;
+            call->tunnel.data[n] = '\0';
+            if (n > 0 && http->url.tls) {
+                /* the server has nothing to say before the TLS handshake */
+                errno = EPROTO;
+                goto fail;
+            }
+            if (_gpt_call_connected(call) == -1)
+                goto fail;
+            break;
+
+#ifdef __GPTSSL__
+        case CALL_HANDSHAKE:
+            if ((rc = SSL_connect((SSL *)c->ssl)) != 1) {
+                switch (SSL_get_error((SSL *)c->ssl, rc)) {
+                case SSL_ERROR_WANT_READ:
+                    want = GPT_EV_READ;
+                    break;
+                case SSL_ERROR_WANT_WRITE:
+                    want = GPT_EV_WRITE;
+                    break;
+                default:
+                    printf("(cgpt): TLS handshake with %s failed: %s\n", http->url.host,
+                            ERR_reason_error_string(ERR_get_error()));
+                    _gpt_call_finish(call, -1);
+                    return;
+                }
+                errno = EAGAIN;
+                goto wait;
+            }
+            if (_gpt_call_connected(call) == -1)
+                goto fail;
+            break;
+#endif
+
+        case CALL_SEND:
+            /* head and body go out together */
+            n = _gpt_http_write(c, call->req.data + call->sent, call->req.len - call->sent, &want);
+            if (n == -1)
+                goto wait;
+            if ((call->sent += n) == call->req.len)
+                call->state = CALL_RECV;
+            break;
+
+        case CALL_RECV:
+            if (call->tunnel.len > 0) {
+                /* the response began with the proxy reply, it is shorter than buf */
+                n = call->tunnel.len;
+                memcpy(buf, call->tunnel.data, n);
+                gpt_buf_reset(&call->tunnel);
+            } else {
+                if ((n = _gpt_http_read(c, buf, sizeof(buf), &want)) == -1)
+                    goto wait;
+                if (gpt_timer_start(call->loop, &call->timer, GPT_HTTP_IO_TIMEOUT * 1000L,
+                                    _gpt_call_expired, call) == -1)
+                    goto fail;
+            }
+            if (n == 0) {
+                if (gpt_http_response_eof(&call->rsp) == 1) {
+                    _gpt_call_finish(call, 0);
+                    return;
+                }
+                errno = ECONNRESET;
+                goto fail;
+            }
+            if ((rc = gpt_http_response_feed(&call->rsp, buf, n)) != 0) {
+                if (rc == 1) {
+                    _gpt_call_finish(call, 0);
+                    return;
+                }
+                errno = EPROTO;
+                goto fail;
+            }
+            break;
+
+        default:
+            goto fail;
+        }
+    }
+    return;
+
+wait:
+    if (errno == EAGAIN && _gpt_call_wait(call, c->fd, want) == 0)
+        return;
+fail:
+    call->dropped = call->reused && call->state == CALL_RECV
+                    && call->rsp.status == 0 && call->rsp.line.len == 0;
+    if (_gpt_call_retry(call) == 0)
+        return;
+    if (call->state >= CALL_SEND)
+        printf("(cgpt): incomplete response from %s: %s\n", http->url.host, strerror(errno));
+    else
+        printf("(cgpt): connect %s:%s %s\n", http->url.host, http->url.port, strerror(errno));
+    _gpt_call_finish(call, -1);
+}
+
+static void
+_gpt_call_ready(gpt_io_t *io, int events) {
+    _gpt_call_step((gpt_call_t *)io->arg);
+}
+
+int
+gpt_call_http(gpt_call_t *call, gpt_http_t *http, const char *body, size_t len) {
+    const gpt_url_t    *to = http->has_proxy ? &http->proxy : &http->url;
+    struct addrinfo     hints;
+    int                 err;
+
+    call->http = http;
+    call->dropped = 0;
+    gpt_buf_reset(&call->tunnel);
+    if (body != NULL) {
+        call->fresh = 0;
+        gpt_buf_reset(&call->req);
+        _gpt_http_head(http, &call->req, len);
+        if (gpt_buf_append(&call->req, body, len) == -1)
+            return -1;
+    }
+
+    if ((err = _gpt_http_acquire(http, &call->conn, call->fresh)) == -1)
+        return -1;
+    call->reused = err == 1;
+    if (call->reused) {
+        call->state = CALL_SEND;
+        call->sent = 0;
+        /* a call nothing times out could hang forever */
+        if (gpt_timer_start(call->loop, &call->timer, GPT_HTTP_IO_TIMEOUT * 1000L,
+                            _gpt_call_expired, call) == -1)
+            goto err;
+        _gpt_call_step(call);
+        return 0;
+    }
+
+    /* a new connection, the deadline of the connect phase is opt.timeout */
+    call->state = CALL_CONNECT;
+    if ((call->conn = (gpt_conn_t *)calloc(1, sizeof(gpt_conn_t))) == NULL)
+        goto err;
+    call->conn->fd = -1;
+
+    if (http->url.sock[0] != '\0') {
+        if (_gpt_call_local(call) == -1) {
+            printf("(cgpt): connect %s %s\n", http->url.sock, strerror(errno));
+            goto err;
+        }
+        if (gpt_timer_start(call->loop, &call->timer, http->timeout * 1000L, _gpt_call_expired, call) == -1)
+            goto err;
+        return 0;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((err = getaddrinfo(to->host, to->port, &hints, &call->addrs)) != 0) {
+        printf("(cgpt): %s: %s\n", to->host, gai_strerror(err));
+        call->addrs = NULL;
+        goto err;
+    }
+    call->ai = call->addrs;
+    if (_gpt_call_connect(call) == -1) {
+        printf("(cgpt): connect %s:%s %s\n", to->host, to->port, strerror(errno));
+        goto err;
+    }
+    if (gpt_timer_start(call->loop, &call->timer, http->timeout * 1000L, _gpt_call_expired, call) == -1)
+        goto err;
+    return 0;
+err:
+    _gpt_call_detach(call, 0);
+    call->state = CALL_IDLE;
+    return -1;
+}
+
+/*
+ * Output of the curl child, read as it arrives
+ */
+static void
+_gpt_call_pipe_ready(gpt_io_t *io, int events) {
+    gpt_call_t *call = (gpt_call_t *)io->arg;
+    char        buf[GPT_MAXBUF];
+    ssize_t     n;
+
+    while ((n = read(io->fd, buf, sizeof(buf))) != 0) {
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                return;
+            _gpt_call_finish(call, -1);
+            return;
+        }
+        if (gpt_timer_start(call->loop, &call->timer, GPT_HTTP_IO_TIMEOUT * 1000L,
+                            _gpt_call_expired, call) == -1)
+            goto err;
+        if (call->rsp.state == HTTP_HEAD) {
+            /* curl tells no status, a JSON object where events were asked for is an error */
+            call->rsp.state = HTTP_BODY_EOF;
+            call->rsp.held = call->rsp.on_body != NULL && buf[0] == '{';
+        }
+        if (_gpt_http_body(&call->rsp, buf, n) == -1)
+            goto err;
+    }
+    /* curl prints nothing at all when the request failed */
+    _gpt_call_finish(call, call->rsp.body.len > 0 ? 0 : -1);
+    return;
+err:
+    _gpt_call_finish(call, -1);
+}
+
+int
+gpt_call_exec(gpt_call_t *call, const char *cmd) {
+    sigset_t    none;
+    int         fds[2];
+
+    if (call->cmd != cmd) {
+        free(call->cmd);
+        if ((call->cmd = strdup(cmd)) == NULL)
+            return -1;
+    }
+    if (pipe(fds) == -1)
+        return -1;
+    if ((call->child = fork()) == -1) {
+        call->child = 0;
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (call->child == 0) {
+        /* Ctrl-C at the terminal is not for curl, cancelling kills it */
+        setpgid(0, 0);
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+    setpgid(call->child, call->child);
+    close(fds[1]);
+    call->pipe = fds[0];
+    call->state = CALL_RECV;
+    if (fcntl(call->pipe, F_SETFD, FD_CLOEXEC) == -1
+        || fcntl(call->pipe, F_SETFL, fcntl(call->pipe, F_GETFL) | O_NONBLOCK) == -1
+        || gpt_loop_add(call->loop, &call->io, call->pipe, GPT_EV_READ,
+                        _gpt_call_pipe_ready, call) == -1
+        || gpt_timer_start(call->loop, &call->timer, GPT_HTTP_IO_TIMEOUT * 1000L,
+                           _gpt_call_expired, call) == -1) {
+        _gpt_call_detach(call, 0);
+        call->state = CALL_IDLE;
+        return -1;
+    }
+    return 0;
+}
+
+void
+gpt_http_response_init(gpt_response_t *rsp) {
+    memset(rsp, 0, sizeof(*rsp));
+    rsp->length = -1;
+    rsp->retry_after = -1;
+    rsp->keepalive = 1;
+    rsp->state = HTTP_HEAD;
+}
+
+/*
+ * Start over for a retried request, the body callback is kept
+ */
+static void
+_gpt_http_response_reset(gpt_response_t *rsp) {
+    void  (*on_body)(gpt_response_t *, const char *, size_t) = rsp->on_body;
+    void   *arg = rsp->arg;
+
+    gpt_http_response_free(rsp);
+    gpt_http_response_init(rsp);
+    rsp->on_body = on_body;
+    rsp->arg = arg;
+}
+
+void
+gpt_http_response_free(gpt_response_t *rsp) {
+    gpt_buf_free(&rsp->line);
+    gpt_buf_free(&rsp->body);
+}
+
+static int
+_gpt_http_has_token(const char *v, const char *token) {
+    size_t len = strlen(token);
+
+    for (; *v; v++) {
+        if (strncasecmp(v, token, len) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static int
+_gpt_http_header_is(const char *line, const char *name, const char **value) {
+    size_t len = strlen(name);
+
+    if (strncasecmp(line, name, len) != 0 || line[len] != ':')
+        return 0;
+    line += len + 1;
+    while (*line == ' ' || *line == '\t')
+        line++;
+    *value = line;
+    return 1;
+}
+
+/*
+ * Retry-After is delay-seconds or an HTTP-date, return ms from now
+ */
+static long
+_gpt_http_retry_after(const char *v) {
+    static const char   months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    struct tm           tm;
+    char                mon[4];
+    const char         *m;
+    time_t              when;
+
+    if (isdigit((unsigned char)*v))
+        return strtol(v, NULL, 10) * 1000;
+    /* Wed, 21 Oct 2015 07:28:00 GMT */
+    memset(&tm, 0, sizeof(tm));
+    if (sscanf(v, "%*3s, %d %3s %d %d:%d:%d", &tm.tm_mday, mon, &tm.tm_year,
+               &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6
+        || (m = strstr(months, mon)) == NULL || (m - months) % 3 != 0)
+        return -1;
+    tm.tm_mon = (m - months) / 3;
+    tm.tm_year -= 1900;
+    when = timegm(&tm) - time(NULL);
+    return when > 0 ? (long)when * 1000 : 0;
+}
+
+/*
+ * Handle one complete line of the response head
+ */
+static int
+_gpt_http_head_line(gpt_response_t *rsp, char *line) {
+    const char *v;
+    int         minor;
+
+    if (rsp->status == 0) {
+        if (sscanf(line, "HTTP/1.%d %d", &minor, &rsp->status) != 2)
+            return -1;
+        if (minor == 0)
+            rsp->keepalive = 0;
+        return 0;
+    }
+
+    if (*line == '\0') {
+        /* 1xx responses are followed by the real one */
+        if (rsp->status >= 100 && rsp->status < 200) {
+            rsp->status = 0;
+            return 0;
+        }
+        rsp->held = rsp->status < 200 || rsp->status >= 300;
+        if (rsp->status == 204 || rsp->status == 304) {
+            rsp->state = HTTP_DONE;
+        } else if (rsp->chunked) {
+            rsp->state = HTTP_CHUNK_SIZE;
+        } else if (rsp->length >= 0) {
+            rsp->left = rsp->length;
+            rsp->state = rsp->left ? HTTP_BODY : HTTP_DONE;
+        } else {
+            rsp->keepalive = 0;
+            rsp->state = HTTP_BODY_EOF;
+        }
+        return 0;
+    }
+
+    if (_gpt_http_header_is(line, "Content-Length", &v)) {
+        rsp->length = strtol(v, NULL, 10);
+    } else if (_gpt_http_header_is(line, "Transfer-Encoding", &v)) {
+        if (_gpt_http_has_token(v, "chunked"))
+            rsp->chunked = 1;
+    } else if (_gpt_http_header_is(line, "Connection", &v)) {
+        if (_gpt_http_has_token(v, "close"))
+            rsp->keepalive = 0;
+    } else if (_gpt_http_header_is(line, "retry-after-ms", &v)) {
+        rsp->retry_after = strtol(v, NULL, 10);
+    } else if (_gpt_http_header_is(line, "Retry-After", &v)) {
+        /* retry-after-ms is finer when both are sent */
+        if (rsp->retry_after < 0)
+            rsp->retry_after = _gpt_http_retry_after(v);
+    }
+    return 0;
+}
+
+static int
+_gpt_http_body(gpt_response_t *rsp, const char *data, size_t len) {
+    if (rsp->on_body != NULL && !rsp->held) {
+        rsp->on_body(rsp, data, len);
+        if (!rsp->keep)
+            return 0;
+    }
+    return gpt_buf_append(&rsp->body, data, len);
+}
+
+int
+gpt_http_response_feed(gpt_response_t *rsp, const char *data, size_t len) {
+    const char *end = data + len;
+    const char *nl;
+    size_t      n;
+
+    while (data < end && rsp->state != HTTP_DONE) {
+        switch (rsp->state) {
+        case HTTP_HEAD:
+        case HTTP_CHUNK_SIZE:
+        case HTTP_CHUNK_END:
+        case HTTP_TRAILER:
+            /* line oriented states, collect up to LF */
+            nl = memchr(data, '\n', end - data);
+            n = nl ? (size_t)(nl - data) : (size_t)(end - data);
+            if (gpt_buf_append(&rsp->line, data, n) == -1)
+                return -1;
+            data += n;
+            if (nl == NULL)
+                break;
+            data++;
+            if (rsp->line.len && rsp->line.data[rsp->line.len - 1] == '\r')
+                rsp->line.data[--rsp->line.len] = '\0';
+
+            if (rsp->state == HTTP_HEAD) {
+                if (_gpt_http_head_line(rsp, rsp->line.data) == -1)
+                    return -1;
+            } else if (rsp->state == HTTP_CHUNK_SIZE) {
+                char *ep;
+                rsp->left = strtoul(rsp->line.data, &ep, 16);
+                if (ep == rsp->line.data)
+                    return -1;
+                rsp->state = rsp->left ? HTTP_CHUNK_DATA : HTTP_TRAILER;
+            } else if (rsp->state == HTTP_CHUNK_END) {
+                rsp->state = HTTP_CHUNK_SIZE;
+            } else if (rsp->line.len == 0) {
+                rsp->state = HTTP_DONE;
+            }
+            gpt_buf_reset(&rsp->line);
+            break;
+        case HTTP_BODY:
+        case HTTP_CHUNK_DATA:
+            n = (size_t)(end - data) < rsp->left ? (size_t)(end - data) : rsp->left;
+            if (_gpt_http_body(rsp, data, n) == -1)
+                return -1;
+            data += n;
+            rsp->left -= n;
+            if (rsp->left == 0)
+                rsp->state = rsp->state == HTTP_BODY ? HTTP_DONE : HTTP_CHUNK_END;
+            break;
+        case HTTP_BODY_EOF:
+            if (_gpt_http_body(rsp, data, end - data) == -1)
+                return -1;
+            data = end;
+            break;
+        }
+    }
+
+    if (rsp->state != HTTP_DONE)
+        return 0;
+    /* anything after the response can not be trusted for reuse */
+    if (data != end)
+        rsp->keepalive = 0;
+    return 1;
+}
+
+int
+gpt_http_response_eof(gpt_response_t *rsp) {
+    rsp->keepalive = 0;
+    if (rsp->state == HTTP_BODY_EOF)
+        rsp->state = HTTP_DONE;
+    return rsp->state == HTTP_DONE ? 1 : -1;
+}
+
+/*
+ * Handle one line of an event stream, a blank line dispatches
+ * the event, only "data:" fields matter for the completions API
+ */
+static void
+_gpt_sse_line(gpt_sse_t *sse, const char *line, size_t len) {
+    if (len == 0) {
+        if (sse->data.len > 0) {
+            sse->events++;
+            sse->on_event(sse->arg, sse->data.data, sse->data.len);
+        }
+        gpt_buf_reset(&sse->data);
+        return;
+    }
+    if (len < 5 || strncmp(line, "data:", 5) != 0)
+        return;
+
+    line += 5;
+    len -= 5;
+    if (len > 0 && *line == ' ') {
+        line++;
+        len--;
+    }
+    if (sse->data.len > 0)
+        gpt_buf_append(&sse->data, "\n", 1);
+    gpt_buf_append(&sse->data, line, len);
+}
+
+int
+gpt_sse_feed(gpt_sse_t *sse, const char *data, size_t len) {
+    const char *end = data + len;
+    const char *nl;
+    size_t      n;
+
+    while (data < end) {
+        nl = memchr(data, '\n', end - data);
+        n = nl ? (size_t)(nl - data) : (size_t)(end - data);
+
+        if (nl == NULL)
+            return gpt_buf_append(&sse->line, data, n);
+
+        if (sse->line.len > 0) {
+            if (gpt_buf_append(&sse->line, data, n) == -1)
+                return -1;
+            if (sse->line.data[sse->line.len - 1] == '\r')
+                sse->line.len--;
+            _gpt_sse_line(sse, sse->line.data, sse->line.len);
+            gpt_buf_reset(&sse->line);
+        } else {
+            _gpt_sse_line(sse, data, (n && data[n - 1] == '\r') ? n - 1 : n);
+        }
+        data = nl + 1;
+    }
+    return 0;
+}
+
+void
+gpt_sse_free(gpt_sse_t *sse) {
+    gpt_buf_free(&sse->line);
+    gpt_buf_free(&sse->data);
+}
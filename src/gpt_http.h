@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ * Native HTTP/1.1 transport, talks to the completions endpoint over a socket
+ * (optionally through an HTTP proxy and TLS) instead of spawning curl.
+ */
+#ifndef __GPT_HTTP__
+#define __GPT_HTTP__
+
+#include <gpt_config.h>
+
+#define GPT_HTTP_IO_TIMEOUT     90      /* seconds without data before giving up */
+#define GPT_POOL_IDLE           30      /* seconds an idle connection is kept */
+#define GPT_POOL_MAX            4       /* connections per (url, proxy) */
+#define GPT_RETRY_MAX           3       /* retries of a transient failure by default */
+#define GPT_RETRY_BASE          500     /* ms before the first retry, doubled for each next */
+#define GPT_RETRY_CAP           30000   /* longest backoff in ms */
+
+/*
+ * Parsed form of opt.url / opt.proxy,
+ * e.g. "https://api.openai.com/v1/chat/completions", or
+ * "unix:/path/to/socket" for a cgpt server on this host
+ */
+struct http_url {
+    int     tls;
+    char    host[256];
+    char    port[8];
+    char    path[1024];
+    char    sock[108];  /* unix socket to connect to instead of host */
+};
+
+/*
+ * One transport connection, plain socket or TLS session
+ */
+struct http_conn {
+    int         fd;
+    void       *ssl;        /* SSL * when built with -DSSL_OPTION */
+    time_t      used;       /* when the connection went idle */
+    unsigned    served;     /* requests completed on this connection */
+    gpt_conn_t *next;
+};
+
+/*
+ * Connections of one (url, proxy) pair, the idle list is
+ * ordered most recently used first.
+ */
+struct http_route {
+    char               *key;
+    gpt_conn_t         *idle;
+    int                 nidle;
+    int                 active;
+    struct http_route  *next;
+};
+
+/*
+ * Keep-alive connections shared by every client attached to the pool,
+ * clients may be used from several threads at once
+ */
+struct http_pool {
+    pthread_mutex_t     lock;
+    struct http_route  *routes;
+    int                 max;        /* connections per route */
+    long                idle;       /* idle timeout in seconds, 0 disables reuse */
+};
+
+struct http_client {
+    gpt_url_t           url;
+    gpt_url_t           proxy;
+    int                 has_proxy;
+    long                timeout;    /* connect timeout in seconds */
+    gpt_buf_t           headers;    /* extra request header lines, "\r\n" terminated */
+    void               *ctx;        /* SSL_CTX * */
+    gpt_pool_t         *pool;
+    struct http_route  *route;
+};
+
+/*
+ * Incremental HTTP response parser, bytes are pushed in as they
+ * arrive and the body is collected in body.
+ */
+struct http_response {
+    int         status;
+    int         keepalive;
+    int         chunked;
+    long        length;     /* Content-Length, -1 if not present */
+    long        retry_after;/* ms the server asked to wait (Retry-After), -1 if not said */
+    int         held;       /* error reply, the body stays in body even with on_body */
+    int         keep;       /* body is collected even when on_body takes it */
+    int         state;
+    size_t      left;       /* bytes left in the current body chunk */
+    gpt_buf_t   line;       /* partially received header / chunk line */
+    gpt_buf_t   body;
+    void      (*on_body)(gpt_response_t *rsp, const char *data, size_t len);
+    void       *arg;        /* when on_body is set body bytes go there instead */
+};
+
+/*
+ * One request driven by the event loop: the native exchange with
+ * the server, or the output of a curl child. When it is over done
+ * is called once with rc set, the body is in rsp.body (unless
+ * rsp.on_body took it). 429 and 5xx replies, rate limit / server
+ * error objects from curl and failures before any reply are tried
+ * again up to retries times, after Retry-After or an exponential
+ * backoff with jitter on a loop timer.
+ */
+struct http_call {
+    gpt_loop_t         *loop;
+    gpt_http_t         *http;       /* NULL for a curl child */
+    gpt_conn_t         *conn;
+    int                 reused;     /* conn came from the pool */
+    int                 fresh;      /* a kept conn went stale, the retry dials a new one */
+    int                 state;
+    struct addrinfo    *addrs;      /* addresses left to try while connecting */
+    struct addrinfo    *ai;
+    gpt_buf_t           req;
+    gpt_buf_t           tunnel;     /* CONNECT request, then the proxy reply */
+    size_t              sent;
+    gpt_response_t      rsp;
+    pid_t               child;      /* curl child, 0 if none */
+    int                 pipe;       /* its stdout, -1 if none */
+    char               *cmd;        /* curl command line, run again on retries */
+    int                 retries;    /* transient failures are retried this often */
+    int                 attempts;   /* retries made so far */
+    int                 dropped;    /* a kept connection closed before any byte of the reply */
+    gpt_limit_t        *limit;      /* admits every retry again, NULL if they are not limited */
+    long                cost;       /* tokens the request was admitted with */
+    gpt_wait_t          wait;
+    int                 waiting;    /* a retry waits for the rate limit */
+    gpt_cache_t        *cache;      /* a completion is stored here under key, may be NULL */
+    uint8_t             key[GPT_CACHE_KEY];
+    int                 keyed;      /* key holds the hash of the body */
+    int                 replayed;   /* answered without a request of its own */
+    gpt_flight_t       *flight;     /* registered here while it runs, may be NULL */
+    gpt_call_t         *leader;     /* the identical call answering this one */
+    gpt_call_t         *followers;  /* calls waiting for this one */
+    gpt_call_t         *next;       /* in the flight, or among the followers */
+    int                 orphan;     /* freed by its owner, runs on for the followers */
+    gpt_io_t            io;
+    gpt_timer_t         timer;      /* connect deadline, then I/O inactivity */
+    int                 rc;         /* 0 for a complete response, otherwise -1 */
+    void              (*done)(gpt_call_t *call);
+    void               *arg;
+};
+
+/*
+ * Requests in flight keyed by the hash of their body, an identical
+ * request joins the one already running instead of being sent again
+ */
+struct http_flight {
+    gpt_call_t *head;       /* calls others may join */
+    long        joined;     /* calls answered by another one */
+};
+
+/*
+ * Server-Sent Events parser (text/event-stream), the data
+ * lines of every event are joined and passed to on_event.
+ */
+struct http_sse {
+    gpt_buf_t   line;
+    gpt_buf_t   data;
+    int         events;     /* number of events delivered */
+    void      (*on_event)(void *arg, const char *data, size_t len);
+    void       *arg;
+};
+
+/*
+ * Parse a url, surrounding quotes (as needed by the shell for curl)
+ * are ignored. Return 0 if successful, otherwise return -1
+ */
+int gpt_http_url(gpt_url_t *u, const char *s, int proxy);
+/*
+ * Create a client for url, going through proxy when it is not empty.
+ * Return NULL when this configuration can not be handled natively,
+ * the caller should then fall back to curl.
+ */
+gpt_http_t *gpt_http_create(const char *url, const char *proxy, long timeout);
+/*
+ * Add a request header such as "Content-Type: application/json",
+ * surrounding quotes are ignored.
+ */
+int gpt_http_header(gpt_http_t *http, const char *line);
+void gpt_http_destroy(gpt_http_t *http);
+/*
+ * Connection pool, max connections per (url, proxy) and
+ * idle seconds before an unused connection is closed
+ */
+gpt_pool_t *gpt_pool_create(int max, long idle);
+void gpt_pool_destroy(gpt_pool_t *pool);
+/*
+ * Share the connections of pool with http, the pool
+ * must outlive every client attached to it
+ */
+int gpt_http_pool(gpt_http_t *http, gpt_pool_t *pool);
+/*
+ * Create a call on loop, rsp.on_body may be set before it is started
+ */
+gpt_call_t *gpt_call_create(gpt_loop_t *loop, void (*done)(gpt_call_t *call), void *arg);
+/*
+ * Start sending body with POST, the connect phase must end within
+ * the client timeout and the response may not stall longer than
+ * GPT_HTTP_IO_TIMEOUT. Return 0 if started (done will be called),
+ * otherwise return -1
+ */
+int gpt_call_http(gpt_call_t *call, gpt_http_t *http, const char *body, size_t len);
+/*
+ * Run cmd (curl) with the shell in a process group of its own and
+ * collect its output, a child still running when the call is over
+ * is killed. Return 0 if started, otherwise return -1
+ */
+int gpt_call_exec(gpt_call_t *call, const char *cmd);
+/*
+ * Look the request body up in cache before starting the call: on a
+ * hit the stored reply answers it on the next loop iteration (return
+ * 1), otherwise a completion will be stored once received (return 0)
+ */
+int gpt_call_cache(gpt_call_t *call, gpt_cache_t *cache, const char *body, size_t len);
+/*
+ * Look the request body up in flight before starting the call: if an
+ * identical call is running this one gets its outcome once it is over
+ * (return 1), otherwise calls started later may join this one until
+ * it is over (return 0)
+ */
+int gpt_call_join(gpt_call_t *call, gpt_flight_t *flight, const char *body, size_t len);
+/*
+ * Whether a call with this request body is in flight
+ */
+int gpt_flight_has(gpt_flight_t *flight, const char *body, size_t len);
+/*
+ * Release the call, one still running is abandoned
+ * unless other calls joined it
+ */
+void gpt_call_free(gpt_call_t *call);
+
+void gpt_http_response_init(gpt_response_t *rsp);
+/*
+ * Feed received bytes into the parser,
+ * return 1 when the response is complete, 0 if more data is
+ * needed and -1 if the response is malformed
+ */
+int gpt_http_response_feed(gpt_response_t *rsp, const char *data, size_t len);
+/*
+ * The peer closed the connection, return 1 if that completes
+ * the response, otherwise -1
+ */
+int gpt_http_response_eof(gpt_response_t *rsp);
+void gpt_http_response_free(gpt_response_t *rsp);
+
+/*
+ * Feed a piece of an event stream, complete events are delivered
+ * to sse->on_event before the function returns
+ */
+int gpt_sse_feed(gpt_sse_t *sse, const char *data, size_t len);
+void gpt_sse_free(gpt_sse_t *sse);
+
+#endif
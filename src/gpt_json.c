@@ -3,47 +3,257 @@
  */
 #include <gpt_config.h>
 
+/*
+ * String member of an object, "" when missing or not a string
+ */
+static const char *
+_gpt_json_str(const cJSON *obj, const char *name) {
+    cJSON *item = cJSON_GetObjectItem(obj, name);
+
+    return cJSON_IsString(item) ? item->valuestring : "";
+}
+
+/*
+ * Reply objects are allocated through the cJSON hooks, so they come
+ * from the request arena when one is current (see gpt_arena_hooks)
+ */
+static void *
+_gpt_json_calloc(size_t n) {
+    void *p = cJSON_malloc(n);
+
+    if (p != NULL)
+        memset(p, 0, n);
+    return p;
+}
+
+static char *
+_gpt_json_strdup(const char *s) {
+    size_t  len = strlen(s) + 1;
+    char   *p = (char *)cJSON_malloc(len);
+
+    if (p != NULL)
+        memcpy(p, s, len);
+    return p;
+}
+
+static int
+_gpt_json_int(const cJSON *obj, const char *name) {
+    cJSON *item = cJSON_GetObjectItem(obj, name);
+
+    return cJSON_IsNumber(item) ? item->valueint : 0;
+}
+
+/*
+ * Append s as a JSON string literal (quotes included), runs of
+ * characters that need no escaping are copied in one go
+ */
 int
-gpt_json_root(const char *js, cJSON **root) {
-    if (js == NULL)
+gpt_json_escape(gpt_buf_t *b, const char *s, size_t len) {
+    static const char   hex[] = "0123456789abcdef";
+    const char         *run = s, *end = s + len;
+    char                esc[6] = { '\\', 'u', '0', '0' };
+    unsigned char       c;
+
+    /* most content needs no escaping, so this is usually the only growth */
+    if (gpt_buf_reserve(b, len + 2) == -1)
         return -1;
-    *root = cJSON_Parse(js);
-    if (root != NULL) {
-        if (cJSON_HasObjectItem(*root, "choices"))
-            return 0;
-        if (cJSON_HasObjectItem(*root, "error"))
-            return 1;
+    gpt_buf_append(b, "\"", 1);
+
+    for (; s < end; s++) {
+        c = (unsigned char)*s;
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+        if (s > run && gpt_buf_append(b, run, s - run) == -1)
+            return -1;
+        run = s + 1;
+
+        switch (c) {
+        case '"':  esc[1] = '"';  break;
+        case '\\': esc[1] = '\\'; break;
+        case '\n': esc[1] = 'n';  break;
+        case '\r': esc[1] = 'r';  break;
+        case '\t': esc[1] = 't';  break;
+        case '\b': esc[1] = 'b';  break;
+        case '\f': esc[1] = 'f';  break;
+        default:
+            esc[1] = 'u';
+            esc[4] = hex[c >> 4];
+            esc[5] = hex[c & 0xF];
+            if (gpt_buf_append(b, esc, 6) == -1)
+                return -1;
+            continue;
+        }
+        if (gpt_buf_append(b, esc, 2) == -1)
+            return -1;
     }
-    
-    return -1;
+    if (s > run && gpt_buf_append(b, run, s - run) == -1)
+        return -1;
+    return gpt_buf_append(b, "\"", 1);
 }
+
 /*
- * Create a request json packet and convert it into a string
+ * {"role":"user","content":"hello world"}
  */
-char *
-gpt_json_data(gpt_request_t *rq, int n) {
-    cJSON           *root;
-    cJSON           *array;
-    gpt_message_t   *gmsg;
-    char            *rp;
+int
+gpt_json_message(gpt_buf_t *b, const char *role, const char *content, size_t len) {
+    if (gpt_buf_puts(b, "{\"role\":") == -1
+        || gpt_json_escape(b, role, strlen(role)) == -1
+        || gpt_buf_puts(b, ",\"content\":") == -1
+        || gpt_json_escape(b, content, len) == -1)
+        return -1;
+    return gpt_buf_append(b, "}", 1);
+}
+
+/*
+ * Everything of the request packet up to the first message:
+ * {"model":"gpt-3.5-turbo","temperature":0.7,"stream":true,"messages":[
+ */
+int
+gpt_json_head(gpt_request_t *rq, gpt_buf_t *b) {
+    char    num[64];
+
+    if (gpt_buf_puts(b, "{\"model\":") == -1
+        || gpt_json_escape(b, rq->model, strlen(rq->model)) == -1)
+        return -1;
+    snprintf(num, sizeof(num), ",\"temperature\":%g", rq->temperature);
+    if (gpt_buf_puts(b, num) == -1)
+        return -1;
+    if (rq->stream && gpt_buf_puts(b, ",\"stream\":true") == -1)
+        return -1;
+    return gpt_buf_puts(b, ",\"messages\":[");
+}
 
-    root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "model", rq->model);
-    cJSON_AddNumberToObject(root, "temperature", rq->temperature);
+int
+gpt_json_tail(gpt_buf_t *b) {
+    return gpt_buf_append(b, "]}", 2);
+}
 
-    array = cJSON_CreateArray();
+/*
+ * Write the compact request packet straight into b:
+ * {"model":"gpt-3.5-turbo","temperature":0.7,"stream":true,
+ *  "messages":[{"role":"user","content":"hello world"}]}
+ */
+int
+gpt_json_data(gpt_request_t *rq, int n, gpt_buf_t *b) {
+    gpt_message_t   *gmsg;
+
+    if (gpt_json_head(rq, b) == -1)
+        return -1;
     gmsg = rq->msg;
     for (int i = 0; i < n; i++) {
-        cJSON *msg = cJSON_CreateObject();
-        cJSON_AddStringToObject(msg, "role", gmsg->role);
-        cJSON_AddStringToObject(msg, "content", gmsg->content);
-        cJSON_AddItemToArray(array, msg);
+        if (i > 0 && gpt_buf_append(b, ",", 1) == -1)
+            return -1;
+        if (gpt_json_message(b, gmsg->role, gmsg->content, strlen(gmsg->content)) == -1)
+            return -1;
         gmsg++;
     }
-    cJSON_AddItemToObject(root, "messages", array);
-    rp = cJSON_Print(root);
+    return gpt_json_tail(b);
+}
+
+static gpt_object_t *
+_gpt_json_object(const cJSON *root) {
+    gpt_object_t    *obj;
+    gpt_choice_t    *pch;
+    cJSON           *jchoices, *usage, *ch, *msg;
+    int              size;
+
+    if ((obj = (gpt_object_t *)_gpt_json_calloc(sizeof(*obj))) == NULL)
+        return NULL;
+
+    strncpy(obj->id, _gpt_json_str(root, "id"), sizeof(obj->id) - 1);
+    strncpy(obj->object, _gpt_json_str(root, "object"), sizeof(obj->object) - 1);
+    strncpy(obj->model, _gpt_json_str(root, "model"), sizeof(obj->model) - 1);
+    obj->created = (uint64_t)cJSON_GetNumberValue(cJSON_GetObjectItem(root, "created"));
+
+    usage = cJSON_GetObjectItem(root, "usage");
+    if (cJSON_IsObject(usage)) {
+        obj->pusage = (gpt_usage_t *)_gpt_json_calloc(sizeof(*obj->pusage));
+        if (obj->pusage != NULL) {
+            obj->pusage->prompt_tokens = _gpt_json_int(usage, "prompt_tokens");
+            obj->pusage->completion_tokens = _gpt_json_int(usage, "completion_tokens");
+            obj->pusage->total_tokens = _gpt_json_int(usage, "total_tokens");
+        }
+    }
+
+    jchoices = cJSON_GetObjectItem(root, "choices");
+    size = cJSON_GetArraySize(jchoices);
+    if (size == 0)
+        return obj;
+
+    obj->choices = (gpt_choice_t *)_gpt_json_calloc(size * sizeof(*obj->choices));
+    if (obj->choices == NULL) {
+        gpt_json_free(obj);
+        return NULL;
+    }
+
+    pch = obj->choices;
+    cJSON_ArrayForEach(ch, jchoices) {
+        strncpy(pch->finish_reason, _gpt_json_str(ch, "finish_reason"),
+                sizeof(pch->finish_reason) - 1);
+        pch->index = _gpt_json_int(ch, "index");
+
+        msg = cJSON_GetObjectItem(ch, "message");
+        strncpy(pch->msg.role, _gpt_json_str(msg, "role"), sizeof(pch->msg.role) - 1);
+        pch->msg.content = _gpt_json_strdup(_gpt_json_str(msg, "content"));
+
+        pch++;
+        obj->choices_num++;
+    }
+    return obj;
+}
+
+/*
+ * {"error": {"message": "...", "type": "requests", "param": null, "code": null}}
+ */
+static gpt_error_t *
+_gpt_json_error(const cJSON *root) {
+    gpt_error_t    *obj;
+    cJSON          *error;
+
+    if ((obj = (gpt_error_t *)_gpt_json_calloc(sizeof(*obj))) == NULL)
+        return NULL;
+
+    error = cJSON_GetObjectItem(root, "error");
+    obj->message = _gpt_json_strdup(_gpt_json_str(error, "message"));
+    strncpy(obj->type, _gpt_json_str(error, "type"), sizeof(obj->type) - 1);
+
+    /* param and code are null more often than not */
+    if (cJSON_IsString(cJSON_GetObjectItem(error, "param")))
+        strncpy(obj->param, _gpt_json_str(error, "param"), sizeof(obj->param) - 1);
+    else
+        strncpy(obj->param, "null", sizeof(obj->param) - 1);
+
+    if (cJSON_IsString(cJSON_GetObjectItem(error, "code")))
+        strncpy(obj->code, _gpt_json_str(error, "code"), sizeof(obj->code) - 1);
+    else
+        strncpy(obj->code, "null", sizeof(obj->code) - 1);
+    return obj;
+}
+
+/*
+ * Parse a reply of the completions API once and build what it holds:
+ * return 0 and set *obj for a completion, return 1 and set *err for
+ * an error object, return -1 if js is neither.
+ */
+int
+gpt_json_response(const char *js, size_t len, gpt_object_t **obj, gpt_error_t **err) {
+    cJSON   *root;
+    int      rc = -1;
+
+    *obj = NULL;
+    *err = NULL;
+    if (js == NULL || (root = cJSON_ParseWithLength(js, len)) == NULL)
+        return -1;
+
+    if (cJSON_HasObjectItem(root, "choices")) {
+        if ((*obj = _gpt_json_object(root)) != NULL)
+            rc = 0;
+    } else if (cJSON_HasObjectItem(root, "error")) {
+        if ((*err = _gpt_json_error(root)) != NULL)
+            rc = 1;
+    }
     cJSON_Delete(root);
-    return rp;
+    return rc;
 }
 
 /*
@@ -71,120 +281,460 @@ gpt_json_data(gpt_request_t *rq, int n) {
  */
 gpt_object_t *
 gpt_json_parse(const char *js) {
-    cJSON           *root;
-    gpt_object_t    *obj = NULL;
+    gpt_object_t    *obj;
+    gpt_error_t     *err;
 
-    obj = (gpt_object_t *)malloc(sizeof(*obj));
-    memset(obj, 0, sizeof(*obj));
+    if (gpt_json_response(js, js ? strlen(js) : 0, &obj, &err) == 1)
+        gpt_json_error_free(err);
+    return obj;
+}
 
-    root = cJSON_Parse(js);
-    //root = cJSON_ParseWithOpts(js + offset, NULL, require_termination);
-    if (root != NULL) {
-        strncpy(obj->id, cJSON_GetObjectItem(root, "id")->valuestring, sizeof(obj->id));
-        strncpy(obj->object, cJSON_GetObjectItem(root, "object")->valuestring, sizeof(obj->object));
-        strncpy(obj->model, cJSON_GetObjectItem(root, "model")->valuestring, sizeof(obj->model));
-        obj->created = cJSON_GetObjectItem(root, "object")->valueint;
-
-        int     size;
-        cJSON  *jchoices;
-        gpt_choice_t *pch;
-
-        jchoices = cJSON_GetObjectItem(root, "choices");
-        size = cJSON_GetArraySize(jchoices);
-
-        obj->choices = (gpt_choice_t *)malloc(size * sizeof(*obj->choices));
-        memset(obj->choices, 0, size * sizeof(*obj->choices));
-
-        pch = obj->choices;
-        for (int i = 0; i < size; i++) {
-            cJSON       *ch, *msg, *content;
-            uint64_t    len = 0;
-
-            ch = cJSON_GetArrayItem(jchoices, i);
-
-            strncpy(pch->finish_reason, 
-                    cJSON_GetObjectItem(ch, "finish_reason")->valuestring,
-                    sizeof(pch->finish_reason));
-            pch->index = cJSON_GetObjectItem(ch, "index")->valueint;
-
-            msg = cJSON_GetObjectItem(ch, "message");
-            content = cJSON_GetObjectItem(msg, "content");
-            len = strlen(content->valuestring);
-            pch->msg.content = (char *)malloc(len + 1);
-            strncpy(pch->msg.content, content->valuestring, len + 1);
-            
-            pch++;
-            obj->choices_num++;
-        }
+/*
+ * In-place scanner behind gpt_json_view. Strings are unescaped over
+ * their own raw text (the decoded form is never longer), members that
+ * are not needed are skipped without building anything.
+ */
+#define GPT_VIEW_DEPTH  64
+
+typedef int (*gpt_view_member)(char **p, const gpt_str_t *key, gpt_view_t *v, void *arg);
+
+static int _gpt_view_value(char **p, int depth);
+
+static inline void
+_gpt_view_ws(char **p) {
+    while (**p == ' ' || **p == '\t' || **p == '\n' || **p == '\r')
+        (*p)++;
+}
+
+static inline int
+_gpt_view_key(const gpt_str_t *key, const char *name) {
+    return strlen(name) == key->len && memcmp(key->s, name, key->len) == 0;
+}
+
+static int
+_gpt_view_hex4(const char *p, unsigned *u) {
+    *u = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        *u <<= 4;
+        if (c >= '0' && c <= '9')      *u |= c - '0';
+        else if (c >= 'a' && c <= 'f') *u |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') *u |= c - 'A' + 10;
+        else return -1;
+    }
+    return 0;
+}
+
+static char *
+_gpt_view_utf8(char *w, unsigned u) {
+    if (u < 0x80) {
+        *w++ = (char)u;
+    } else if (u < 0x800) {
+        *w++ = (char)(0xC0 | (u >> 6));
+        *w++ = (char)(0x80 | (u & 0x3F));
+    } else if (u < 0x10000) {
+        *w++ = (char)(0xE0 | (u >> 12));
+        *w++ = (char)(0x80 | ((u >> 6) & 0x3F));
+        *w++ = (char)(0x80 | (u & 0x3F));
     } else {
-        printf("(cgpt): Error before: [%s]\n",cJSON_GetErrorPtr());
-        return NULL;
+        *w++ = (char)(0xF0 | (u >> 18));
+        *w++ = (char)(0x80 | ((u >> 12) & 0x3F));
+        *w++ = (char)(0x80 | ((u >> 6) & 0x3F));
+        *w++ = (char)(0x80 | (u & 0x3F));
     }
-    
-    if (root)
-        cJSON_Delete(root);
-    return obj;
+    return w;
 }
 
-void 
-gpt_json_free(gpt_object_t *obj) {
-    if (obj != NULL && obj->choices != NULL) {
-        for (int i = 0; i < obj->choices_num; i++) {
-            gpt_choice_t *ch = obj->choices + i;
-            free(ch->msg.content);
+/*
+ * *p is at the opening quote, out (may be NULL) gets the decoded text
+ */
+static int
+_gpt_view_string(char **p, gpt_str_t *out) {
+    char       *r = *p + 1, *w = r, *start = r;
+    unsigned    u, lo;
+
+    while (*r != '"') {
+        if (*r == '\0')
+            return -1;
+        if (*r != '\\') {
+            *w++ = *r++;
+            continue;
         }
-        free(obj->choices);
-        free(obj);
-    } 
+        switch (r[1]) {
+        case '"':  *w++ = '"';  break;
+        case '\\': *w++ = '\\'; break;
+        case '/':  *w++ = '/';  break;
+        case 'b':  *w++ = '\b'; break;
+        case 'f':  *w++ = '\f'; break;
+        case 'n':  *w++ = '\n'; break;
+        case 'r':  *w++ = '\r'; break;
+        case 't':  *w++ = '\t'; break;
+        case 'u':
+            if (_gpt_view_hex4(r + 2, &u) == -1)
+                return -1;
+            r += 4;
+            /* a high surrogate must be followed by the low one */
+            if (u >= 0xD800 && u <= 0xDBFF) {
+                if (r[2] != '\\' || r[3] != 'u' || _gpt_view_hex4(r + 4, &lo) == -1
+                    || lo < 0xDC00 || lo > 0xDFFF)
+                    return -1;
+                u = 0x10000 + ((u - 0xD800) << 10) + (lo - 0xDC00);
+                r += 6;
+            }
+            w = _gpt_view_utf8(w, u);
+            break;
+        default:
+            return -1;
+        }
+        r += 2;
+    }
+    if (out != NULL) {
+        out->s = start;
+        out->len = w - start;
+    }
+    *p = r + 1;
+    return 0;
 }
 
-gpt_error_t *
-gpt_json_error(const char *js) {
-    cJSON          *root;
-    gpt_error_t    *obj = NULL;
+static int
+_gpt_view_number(char **p, double *d) {
+    char   *end;
+    double  val = strtod(*p, &end);
 
-    obj = (gpt_error_t *)calloc(1, sizeof(*obj));
+    if (end == *p)
+        return -1;
+    if (d != NULL)
+        *d = val;
+    *p = end;
+    return 0;
+}
 
-    root = cJSON_Parse(js);
-    if (root != NULL) {
-        cJSON  *error = NULL, *param = NULL, *code = NULL;
-
-        error = cJSON_GetObjectItem(root, "error");
-
-        obj->message = (char *)calloc(1, sizeof(*obj->message));
-        strncpy(obj->message, 
-                cJSON_GetObjectItem(error, "message")->valuestring,
-                sizeof(obj->message));
-        strncpy(obj->type, 
-                cJSON_GetObjectItem(error, "type")->valuestring,
-                sizeof(obj->type));
-        
-        param = cJSON_GetObjectItem(error, "param");
-        if (cJSON_IsNull(param)) {
-            strncpy(obj->type, "null", sizeof(obj->param));
+/*
+ * Walk the members of the object at *p, calling member for each one,
+ * member either consumes the value or returns 0 to have it skipped
+ */
+static int
+_gpt_view_object(char **p, int depth, gpt_view_member member, gpt_view_t *v, void *arg) {
+    gpt_str_t   key;
+    int         rc;
+
+    if (depth > GPT_VIEW_DEPTH || **p != '{')
+        return -1;
+    (*p)++;
+    _gpt_view_ws(p);
+    if (**p == '}') {
+        (*p)++;
+        return 0;
+    }
+
+    while (1) {
+        _gpt_view_ws(p);
+        if (**p != '"' || _gpt_view_string(p, &key) == -1)
+            return -1;
+        _gpt_view_ws(p);
+        if (**p != ':')
+            return -1;
+        (*p)++;
+        _gpt_view_ws(p);
+
+        rc = member ? member(p, &key, v, arg) : 0;
+        if (rc == -1 || (rc == 0 && _gpt_view_value(p, depth + 1) == -1))
+            return -1;
+
+        _gpt_view_ws(p);
+        if (**p == ',') {
+            (*p)++;
+        } else if (**p == '}') {
+            (*p)++;
+            return 0;
         } else {
-            strncpy(obj->param, 
-                cJSON_GetObjectItem(error, "param")->valuestring,
-                sizeof(obj->param));
+            return -1;
         }
+    }
+}
 
-        code = cJSON_GetObjectItem(error, "code");
-        if (cJSON_IsNull(code)) {
-            strncpy(obj->code, "null", sizeof(obj->code));
-        } else {
-            strncpy(obj->code, 
-                cJSON_GetObjectItem(error, "code")->valuestring,
-                sizeof(obj->code));
+static int
+_gpt_view_value(char **p, int depth) {
+    if (depth > GPT_VIEW_DEPTH)
+        return -1;
+
+    switch (**p) {
+    case '{':
+        return _gpt_view_object(p, depth, NULL, NULL, NULL);
+    case '[':
+        (*p)++;
+        _gpt_view_ws(p);
+        if (**p == ']') {
+            (*p)++;
+            return 0;
         }
+        while (1) {
+            _gpt_view_ws(p);
+            if (_gpt_view_value(p, depth + 1) == -1)
+                return -1;
+            _gpt_view_ws(p);
+            if (**p == ']') {
+                (*p)++;
+                return 0;
+            }
+            if (**p != ',')
+                return -1;
+            (*p)++;
+        }
+    case '"':
+        return _gpt_view_string(p, NULL);
+    case 't':
+        if (strncmp(*p, "true", 4) != 0) return -1;
+        *p += 4;
+        return 0;
+    case 'f':
+        if (strncmp(*p, "false", 5) != 0) return -1;
+        *p += 5;
+        return 0;
+    case 'n':
+        if (strncmp(*p, "null", 4) != 0) return -1;
+        *p += 4;
+        return 0;
+    default:
+        return _gpt_view_number(p, NULL);
     }
-    return obj;
+}
+
+/*
+ * Read a string member, null leaves the view empty
+ */
+static int
+_gpt_view_str(char **p, gpt_str_t *out) {
+    if (**p == '"')
+        return _gpt_view_string(p, out) == -1 ? -1 : 1;
+    return 0;
+}
+
+static int
+_gpt_view_int(char **p, int *out) {
+    double d;
+
+    if (**p != '-' && (**p < '0' || **p > '9'))
+        return 0;
+    if (_gpt_view_number(p, &d) == -1)
+        return -1;
+    *out = (int)d;
+    return 1;
+}
+
+static int
+_gpt_view_message(char **p, const gpt_str_t *key, gpt_view_t *v, void *arg) {
+    struct view_choice *ch = (struct view_choice *)arg;
+
+    if (_gpt_view_key(key, "role"))
+        return _gpt_view_str(p, &ch->role);
+    if (_gpt_view_key(key, "content"))
+        return _gpt_view_str(p, &ch->content);
+    return 0;
+}
+
+static int
+_gpt_view_choice(char **p, const gpt_str_t *key, gpt_view_t *v, void *arg) {
+    struct view_choice *ch = (struct view_choice *)arg;
+
+    if (_gpt_view_key(key, "message") && **p == '{')
+        return _gpt_view_object(p, 3, _gpt_view_message, v, ch) == -1 ? -1 : 1;
+    if (_gpt_view_key(key, "finish_reason"))
+        return _gpt_view_str(p, &ch->finish_reason);
+    if (_gpt_view_key(key, "index"))
+        return _gpt_view_int(p, &ch->index);
+    return 0;
+}
+
+static int
+_gpt_view_choices(char **p, gpt_view_t *v) {
+    struct view_choice  skip;
+
+    (*p)++;
+    _gpt_view_ws(p);
+    if (**p == ']') {
+        (*p)++;
+        return 1;
+    }
+    while (1) {
+        /* choices beyond GPT_VIEW_CHOICES are scanned but dropped */
+        struct view_choice *ch = v->choices_num < GPT_VIEW_CHOICES
+                                    ? &v->choices[v->choices_num++] : &skip;
+
+        memset(ch, 0, sizeof(*ch));
+        _gpt_view_ws(p);
+        if (_gpt_view_object(p, 2, _gpt_view_choice, v, ch) == -1)
+            return -1;
+        _gpt_view_ws(p);
+        if (**p == ']') {
+            (*p)++;
+            return 1;
+        }
+        if (**p != ',')
+            return -1;
+        (*p)++;
+    }
+}
+
+static int
+_gpt_view_usage(char **p, const gpt_str_t *key, gpt_view_t *v, void *arg) {
+    if (_gpt_view_key(key, "prompt_tokens"))
+        return _gpt_view_int(p, &v->usage.prompt_tokens);
+    if (_gpt_view_key(key, "completion_tokens"))
+        return _gpt_view_int(p, &v->usage.completion_tokens);
+    if (_gpt_view_key(key, "total_tokens"))
+        return _gpt_view_int(p, &v->usage.total_tokens);
+    return 0;
+}
+
+static int
+_gpt_view_error(char **p, const gpt_str_t *key, gpt_view_t *v, void *arg) {
+    if (_gpt_view_key(key, "message"))
+        return _gpt_view_str(p, &v->message);
+    if (_gpt_view_key(key, "type"))
+        return _gpt_view_str(p, &v->type);
+    if (_gpt_view_key(key, "param"))
+        return _gpt_view_str(p, &v->param);
+    if (_gpt_view_key(key, "code"))
+        return _gpt_view_str(p, &v->code);
+    return 0;
+}
+
+static int
+_gpt_view_root(char **p, const gpt_str_t *key, gpt_view_t *v, void *arg) {
+    int    *kind = (int *)arg;
+    double  d;
+
+    if (_gpt_view_key(key, "choices") && **p == '[') {
+        *kind = 0;
+        return _gpt_view_choices(p, v);
+    }
+    if (_gpt_view_key(key, "error") && **p == '{') {
+        *kind = 1;
+        v->error = 1;
+        return _gpt_view_object(p, 1, _gpt_view_error, v, NULL) == -1 ? -1 : 1;
+    }
+    if (_gpt_view_key(key, "usage") && **p == '{')
+        return _gpt_view_object(p, 1, _gpt_view_usage, v, NULL) == -1 ? -1 : 1;
+    if (_gpt_view_key(key, "id"))
+        return _gpt_view_str(p, &v->id);
+    if (_gpt_view_key(key, "object"))
+        return _gpt_view_str(p, &v->object);
+    if (_gpt_view_key(key, "model"))
+        return _gpt_view_str(p, &v->model);
+    if (_gpt_view_key(key, "created") && **p != 'n') {
+        if (_gpt_view_number(p, &d) == -1)
+            return -1;
+        v->created = (uint64_t)d;
+        return 1;
+    }
+    return 0;
+}
+
+int
+gpt_json_view(char *buf, size_t len, gpt_view_t *v) {
+    char   *p = buf;
+    int     kind = -1;
+
+    memset(v, 0, sizeof(*v));
+    v->buf = buf;
+    if (buf == NULL || len == 0 || buf[len] != '\0')
+        return -1;
+
+    _gpt_view_ws(&p);
+    if (_gpt_view_object(&p, 0, _gpt_view_root, v, &kind) == -1)
+        return -1;
+    return kind;
+}
+
+void
+gpt_json_view_free(gpt_view_t *v) {
+    free(v->buf);
+    v->buf = NULL;
+}
+
+/*
+ * One event of a streamed reply:
+ * {"id":"chatcmpl-...","object":"chat.completion.chunk","created":1681223664,
+ *  "model":"gpt-3.5-turbo-0301",
+ *  "choices":[{"delta":{"content":" world"},"index":0,"finish_reason":null}]}
+ * Return the content of the delta, NULL if the chunk has none (role only
+ * or finish chunk). The returned value needs to call cJSON_free to release.
+ */
+char *
+gpt_json_delta(const char *js) {
+    cJSON   *root, *choice, *content;
+    char    *s = NULL;
+
+    if ((root = cJSON_Parse(js)) == NULL)
+        return NULL;
+
+    choice = cJSON_GetArrayItem(cJSON_GetObjectItem(root, "choices"), 0);
+    content = cJSON_GetObjectItem(cJSON_GetObjectItem(choice, "delta"), "content");
+    if (cJSON_IsString(content))
+        s = _gpt_json_strdup(content->valuestring);
+
+    cJSON_Delete(root);
+    return s;
+}
+
+int
+gpt_json_request(const char *js, size_t len, int *stream, int *messages, gpt_buf_t *text) {
+    cJSON       *root, *msgs, *m, *content;
+    const char  *end = NULL;
+    int          rc = -1;
+
+    *stream = 0;
+    *messages = 0;
+    if ((root = cJSON_ParseWithLengthOpts(js, len, &end, 0)) == NULL)
+        return -1;
+    /* nothing but blanks may follow the object */
+    while (end < js + len && isspace((unsigned char)*end))
+        end++;
+
+    msgs = cJSON_GetObjectItem(root, "messages");
+    if (end == js + len && cJSON_IsObject(root) && cJSON_IsArray(msgs)) {
+        *stream = cJSON_IsTrue(cJSON_GetObjectItem(root, "stream"));
+        cJSON_ArrayForEach(m, msgs) {
+            content = cJSON_GetObjectItem(m, "content");
+            if (text != NULL && cJSON_IsString(content))
+                gpt_buf_puts(text, content->valuestring);
+            (*messages)++;
+        }
+        rc = 0;
+    }
+    cJSON_Delete(root);
+    return rc;
+}
+
+void 
+gpt_json_free(gpt_object_t *obj) {
+    if (obj == NULL)
+        return;
+    for (int i = 0; i < obj->choices_num; i++) {
+        gpt_choice_t *ch = obj->choices + i;
+        cJSON_free(ch->msg.content);
+    }
+    cJSON_free(obj->choices);
+    cJSON_free(obj->pusage);
+    cJSON_free(obj);
+}
+
+gpt_error_t *
+gpt_json_error(const char *js) {
+    gpt_object_t    *obj;
+    gpt_error_t     *err;
+
+    if (gpt_json_response(js, js ? strlen(js) : 0, &obj, &err) == 0)
+        gpt_json_free(obj);
+    return err;
 }
 
 void
 gpt_json_error_free(gpt_error_t *obj) {
     if (obj != NULL) {
-        free(obj->message);
-        free(obj);
+        cJSON_free(obj->message);
+        cJSON_free(obj);
     }
 }
 
@@ -202,6 +752,9 @@ gpt_json_file(const char *js) {
         obj->head = strdup(cJSON_GetObjectItem(root, "head")->valuestring);
         obj->proxy = strdup(cJSON_GetObjectItem(root, "proxy")->valuestring);
         obj->timeout = cJSON_GetObjectItem(root, "timeout")->valueint;
+        obj->stream = cJSON_IsTrue(cJSON_GetObjectItem(root, "stream"));
+        if (cJSON_IsString(cJSON_GetObjectItem(root, "system")))
+            obj->system = strdup(cJSON_GetObjectItem(root, "system")->valuestring);
     }
 
     if (root)
@@ -217,6 +770,7 @@ gpt_json_file_free(gpt_jfile_t *obj) {
         free(obj->url);
         free(obj->head);
         free(obj->proxy);
+        free(obj->system);
         free(obj);
     }
 }
\ No newline at end of file
@@ -24,6 +24,7 @@ struct request {
     char model[32];
     gpt_message_t *msg;
     float temperature;
+    int stream;             // reply as server-sent events
 };
 
 struct choice {
@@ -49,17 +50,89 @@ struct error {
     char code[32];
 };
 
+/*
+ * Borrowed string, points into the buffer of a gpt_view_t
+ * and is not NUL terminated
+ */
+struct strview {
+    const char *s;
+    size_t      len;
+};
+
+#define GPT_VIEW_CHOICES    8
+
+struct view_choice {
+    gpt_str_t   role;
+    gpt_str_t   content;
+    gpt_str_t   finish_reason;
+    int         index;
+};
+
+/*
+ * Zero-copy form of a reply: the receive buffer is decoded in place
+ * and every string is a view into it, gpt_json_view_free releases
+ * everything at once. error is set for an error object, then only
+ * message, type, param and code are filled in.
+ */
+struct view {
+    char               *buf;
+    int                 error;
+    gpt_str_t           id;
+    gpt_str_t           object;
+    gpt_str_t           model;
+    uint64_t            created;
+    gpt_usage_t         usage;
+    struct view_choice  choices[GPT_VIEW_CHOICES];
+    int                 choices_num;
+    gpt_str_t           message;
+    gpt_str_t           type;
+    gpt_str_t           param;
+    gpt_str_t           code;
+};
+
 struct jfile {
     char *key;
     char *url;
     char *head;
     char *proxy;
+    char *system;
     int  timeout;
+    int  stream;
 };
 
-int gpt_json_root(const char *js, cJSON **root);
-char *gpt_json_data(gpt_request_t *rq, int n);
+/*
+ * Append s as a quoted and escaped JSON string
+ */
+int gpt_json_escape(gpt_buf_t *b, const char *s, size_t len);
+int gpt_json_message(gpt_buf_t *b, const char *role, const char *content, size_t len);
+/*
+ * Opening of the request packet up to the messages array, and its end
+ */
+int gpt_json_head(gpt_request_t *rq, gpt_buf_t *b);
+int gpt_json_tail(gpt_buf_t *b);
+/*
+ * Serialize the request for n messages into b,
+ * return 0 if successful, otherwise return -1
+ */
+int gpt_json_data(gpt_request_t *rq, int n, gpt_buf_t *b);
+int gpt_json_response(const char *js, size_t len, gpt_object_t **obj, gpt_error_t **err);
+/*
+ * Decode the reply in buf (NUL terminated, len bytes) in place in one
+ * pass, the view takes ownership of buf even when parsing fails.
+ * Return 0 for a completion, 1 for an error object, -1 otherwise.
+ */
+int gpt_json_view(char *buf, size_t len, gpt_view_t *v);
+void gpt_json_view_free(gpt_view_t *v);
 gpt_object_t *gpt_json_parse(const char *js);
+char *gpt_json_delta(const char *js);
+/*
+ * Check a completion request sent by a client: an object with a
+ * messages array. *stream tells whether events are asked for, the
+ * number of messages goes to *messages and their contents are
+ * appended to text (for token counts) unless it is NULL.
+ * Return 0 if successful, otherwise return -1
+ */
+int gpt_json_request(const char *js, size_t len, int *stream, int *messages, gpt_buf_t *text);
 void gpt_json_free(gpt_object_t *obj);
 gpt_error_t *gpt_json_error(const char *js);
 void gpt_json_error_free(gpt_error_t *obj);
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ */
+#include <gpt_config.h>
+
+/*
+ * Bucket size of a per minute rate, the server enforces
+ * quotas over parts of a minute as well
+ */
+static double
+_gpt_limit_cap(double rate) {
+    double cap = rate * GPT_LIMIT_BURST / 60;
+
+    return cap > 1 ? cap : 1;
+}
+
+static void
+_gpt_limit_refill(gpt_limit_t *l) {
+    uint64_t    now = gpt_loop_now(l->loop);
+    double      ms = (double)(now - l->last);
+
+    l->last = now;
+    if (l->rpm > 0 && (l->requests += ms * l->rpm / 60000) > _gpt_limit_cap(l->rpm))
+        l->requests = _gpt_limit_cap(l->rpm);
+    if (l->tpm > 0 && (l->tokens += ms * l->tpm / 60000) > _gpt_limit_cap(l->tpm))
+        l->tokens = _gpt_limit_cap(l->tpm);
+}
+
+/*
+ * ms until a request of tokens can be paid for, 0 if it can now.
+ * One larger than the token bucket goes once the bucket is full.
+ */
+static long
+_gpt_limit_due(gpt_limit_t *l, long tokens) {
+    double  ms = 0, t, need;
+
+    if (l->rpm > 0 && l->requests < 1)
+        ms = (1 - l->requests) * 60000 / l->rpm;
+    if (l->tpm > 0) {
+        need = tokens < _gpt_limit_cap(l->tpm) ? tokens : _gpt_limit_cap(l->tpm);
+        if (l->tokens < need && (t = (need - l->tokens) * 60000 / l->tpm) > ms)
+            ms = t;
+    }
+    return (long)ceil(ms);
+}
+
+static void
+_gpt_limit_take(gpt_limit_t *l, long tokens) {
+    if (l->rpm > 0)
+        l->requests -= 1;
+    if (l->tpm > 0)
+        l->tokens -= tokens;
+}
+
+static void _gpt_limit_ready(gpt_timer_t *t);
+
+static void
+_gpt_limit_schedule(gpt_limit_t *l) {
+    if (l->head == NULL) {
+        gpt_timer_stop(l->loop, &l->timer);
+        return;
+    }
+    gpt_timer_start(l->loop, &l->timer, _gpt_limit_due(l, l->head->tokens),
+                    _gpt_limit_ready, l);
+}
+
+/*
+ * Admit whoever can be paid for now, in the order they came
+ */
+static void
+_gpt_limit_ready(gpt_timer_t *t) {
+    gpt_limit_t    *l = (gpt_limit_t *)t->arg;
+    gpt_wait_t     *w;
+    uint64_t        ms;
+
+    _gpt_limit_refill(l);
+    while ((w = l->head) != NULL && _gpt_limit_due(l, w->tokens) == 0) {
+        if ((l->head = w->next) == NULL)
+            l->tail = NULL;
+        _gpt_limit_take(l, w->tokens);
+        ms = gpt_loop_now(l->loop) - w->since;
+        l->waited += ms;
+        if (ms > l->longest)
+            l->longest = ms;
+        w->fn(w);
+    }
+    _gpt_limit_schedule(l);
+}
+
+void
+gpt_limit_init(gpt_limit_t *l, gpt_loop_t *loop, long rpm, long tpm) {
+    memset(l, 0, sizeof(*l));
+    l->loop = loop;
+    l->rpm = rpm > 0 ? rpm : 0;
+    l->tpm = tpm > 0 ? tpm : 0;
+    /* the first burst may go at once */
+    l->requests = _gpt_limit_cap(l->rpm);
+    l->tokens = _gpt_limit_cap(l->tpm);
+    l->last = gpt_loop_now(loop);
+    l->reply = GPT_LIMIT_REPLY;
+    l->timer.index = -1;
+}
+
+void
+gpt_limit_free(gpt_limit_t *l) {
+    gpt_timer_stop(l->loop, &l->timer);
+    l->head = l->tail = NULL;
+}
+
+long
+gpt_limit_estimate(gpt_limit_t *l, long prompt) {
+    return prompt + (long)l->reply;
+}
+
+int
+gpt_limit_acquire(gpt_limit_t *l, gpt_wait_t *w, long tokens,
+                  void (*fn)(gpt_wait_t *w), void *arg) {
+    _gpt_limit_refill(l);
+    if (l->head == NULL && _gpt_limit_due(l, tokens) == 0) {
+        _gpt_limit_take(l, tokens);
+        return 0;
+    }
+
+    w->tokens = tokens;
+    w->since = gpt_loop_now(l->loop);
+    w->fn = fn;
+    w->arg = arg;
+    w->next = NULL;
+    if (l->tail != NULL)
+        l->tail->next = w;
+    else
+        l->head = w;
+    l->tail = w;
+    l->queued++;
+    if (l->head == w)
+        _gpt_limit_schedule(l);
+    return 1;
+}
+
+void
+gpt_limit_cancel(gpt_limit_t *l, gpt_wait_t *w) {
+    gpt_wait_t **pp;
+
+    for (pp = &l->head; *pp != NULL; pp = &(*pp)->next) {
+        if (*pp != w)
+            continue;
+        *pp = w->next;
+        if (l->tail == w) {
+            l->tail = NULL;
+            for (w = l->head; w != NULL; w = w->next)
+                l->tail = w;
+        }
+        _gpt_limit_schedule(l);
+        return;
+    }
+}
+
+void
+gpt_limit_settle(gpt_limit_t *l, long estimated, long prompt, long completion) {
+    /* tokens the estimate took too many come back, too few are owed */
+    if (l->tpm > 0) {
+        _gpt_limit_refill(l);
+        l->tokens += estimated - (prompt + completion);
+        if (l->tokens > _gpt_limit_cap(l->tpm))
+            l->tokens = _gpt_limit_cap(l->tpm);
+    }
+    if (prompt + completion > 0)
+        l->reply += (completion - l->reply) / 8;
+    _gpt_limit_schedule(l);
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ * Client side rate limit: token buckets for the requests and the tokens
+ * per minute of an API key. Requests wait in order on the loop until
+ * both buckets can pay for them, the token bucket is corrected with the
+ * usage the server reports.
+ */
+#ifndef __GPT_LIMIT__
+#define __GPT_LIMIT__
+
+#include <gpt_config.h>
+
+#define GPT_LIMIT_BURST     6       /* seconds of quota that may go out at once */
+#define GPT_LIMIT_REPLY     256     /* tokens a reply is expected to take before any was seen */
+
+/*
+ * A request waiting for admission, embedded in its owner
+ */
+struct limit_wait {
+    long                tokens;     /* estimate of the request, reply included */
+    uint64_t            since;      /* when it started waiting */
+    void              (*fn)(gpt_wait_t *w);
+    void               *arg;
+    gpt_wait_t         *next;
+};
+
+struct limit {
+    gpt_loop_t         *loop;
+    double              rpm;        /* requests per minute, 0 is no limit */
+    double              tpm;        /* tokens per minute, 0 is no limit */
+    double              requests;   /* left in the buckets, tokens may go below 0 */
+    double              tokens;
+    uint64_t            last;       /* when the buckets were last filled up */
+    double              reply;      /* running mean of completion tokens */
+    gpt_timer_t         timer;
+    gpt_wait_t         *head;       /* waiting, first come first served */
+    gpt_wait_t         *tail;
+    long                queued;     /* requests that had to wait */
+    uint64_t            waited;     /* ms they waited in total */
+    uint64_t            longest;
+};
+
+void gpt_limit_init(gpt_limit_t *l, gpt_loop_t *loop, long rpm, long tpm);
+void gpt_limit_free(gpt_limit_t *l);
+/*
+ * Tokens a request with prompt tokens is expected to take, reply included
+ */
+long gpt_limit_estimate(gpt_limit_t *l, long prompt);
+/*
+ * Admit a request of tokens. Return 0 if it may go now, otherwise
+ * return 1, w waits and fn is called once it is admitted
+ */
+int gpt_limit_acquire(gpt_limit_t *l, gpt_wait_t *w, long tokens,
+                      void (*fn)(gpt_wait_t *w), void *arg);
+void gpt_limit_cancel(gpt_limit_t *l, gpt_wait_t *w);
+/*
+ * A request admitted with estimated tokens used prompt + completion,
+ * both 0 when the reply did not come from the server
+ */
+void gpt_limit_settle(gpt_limit_t *l, long estimated, long prompt, long completion);
+
+#endif
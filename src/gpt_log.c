@@ -2,6 +2,9 @@
  * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
  */
 #include <gpt_config.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/uio.h>
 
 #define LOG_BUFF            4096
 #define CLOG_DEFAULT_FORMAT "%d %t %f(%n): %l: %m\n"
@@ -15,6 +18,8 @@ static const char *const CLOG_LEVEL_NAMES[] = {
     "FATAL"
 };
 
+static const unsigned char CLOG_LEVEL_LENS[] = {5, 5, 4, 4, 5, 5};
+
 enum {
     MAXFILELEN  = 255,
     MAXFILESIZE = 1048576L, /* 1 MB */
@@ -40,223 +45,592 @@ _gpt_clog_basename(const char *path) {
 static char *
 _gpt_clog_time(const gpt_clog_t *clog, char *timestamp, size_t size)
 {
-    time_t t;
-    time(&t);
-
-    return get_time_fmt(timestamp, size, t, clog->tfmt);
+    return get_time_now(timestamp, size, clog->tfmt);
 }
 
+/*
+ * Log file of the day of t in dir, dir ends with a slash
+ */
 static void
-_gpt_clog_filename(char *dst, uint32_t size, const char *src)
+_gpt_clog_filename(char *dst, uint32_t size, const char *dir, time_t t)
 {
-    char    *path = NULL, *fname = NULL;
-    char     name[32] = {0};
-    time_t   tm;
+    char    name[32] = {0};
 
-    if ((path = path_normalize(src)) == NULL) {
-        _gpt_clog_err("(clog): path normalize faild.\n");
-        goto out;
+    snprintf(dst, size, "%s%s", dir, get_time_fmt(name, sizeof(name), t, gf_timefmt_day));
+}
+
+/*
+ * Open the log file of the day of now, the
+ * old descriptor is left to the caller
+ */
+static int
+_gpt_clog_open(gpt_clog_t *clog, time_t now)
+{
+    struct stat st;
+    struct tm   tm;
+    int         fd;
+
+    _gpt_clog_filename(clog->filename, sizeof(clog->filename), clog->dir, now);
+    /*
+     * The open() system call opens the file specified by pathname.  
+     * If the specified file does not exist, it may op‐tionally 
+     * (if O_CREAT is specified in flags) be created by open().
+     */
+    if ((fd = open(clog->filename, O_CREAT | O_WRONLY | O_APPEND | O_CLOEXEC, 0666)) == -1) {
+        _gpt_clog_err("(clog): open() %s function failed. %s\n", clog->filename, strerror(errno));
+        return -1;
     }
+    clog->size = fstat(fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+
+    /* the next local midnight starts another file */
+    localtime_r(&now, &tm);
+    tm.tm_sec = tm.tm_min = tm.tm_hour = 0;
+    tm.tm_mday++;
+    tm.tm_isdst = -1;
+    clog->until = mktime(&tm);
+    return fd;
+}
 
-    // stitching path
-    strncpy(dst, path, size);
-    if (dst[strlen(dst) - 1] != '/')
-        strcat(dst, "/");
-
-    time(&tm);
-    fname = get_time_fmt(name, sizeof(name), tm, gf_timefmt_day);
-    strcat(dst, fname);
-
-out:
-    // copy memory, so free
-    if (path) {
-        free(path);
-        path = NULL;
+#ifdef __GPTCLOG__
+/* only a log file is rolled over */
+
+/*
+ * gzip a file that is no longer written, in a grandchild so
+ * nobody has to wait for it
+ */
+static void
+_gpt_clog_compress(const char *file)
+{
+    pid_t   pid;
+    int     status, fd;
+
+    if ((pid = fork()) == -1)
+        return;
+    if (pid == 0) {
+        if (fork() == 0) {
+            /* the file may be gone already, nothing to tell */
+            if ((fd = open("/dev/null", O_WRONLY)) != -1)
+                dup2(fd, STDERR_FILENO);
+            execlp("gzip", "gzip", "-f", "-q", "--", file, (char *)NULL);
+            _exit(127);
+        }
+        _exit(0);
     }
-    return;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+        ;
 }
 
-static size_t
-_gpt_clog_append_str(char **dst, char *orig_buf, const char *src, size_t cur_size)
+struct clog_old {
+    struct timespec mtime;
+    char            name[256];
+};
+
+/*
+ * Older first, files of the same moment by their
+ * name so that "<day>.9" comes before "<day>.10"
+ */
+static int
+_gpt_clog_oldest(const void *a, const void *b)
 {
-    size_t new_size = cur_size;
+    const struct clog_old *x = a, *y = b;
+    size_t lx = strlen(x->name), ly = strlen(y->name);
+
+    if (x->mtime.tv_sec != y->mtime.tv_sec)
+        return x->mtime.tv_sec < y->mtime.tv_sec ? -1 : 1;
+    if (x->mtime.tv_nsec != y->mtime.tv_nsec)
+        return x->mtime.tv_nsec < y->mtime.tv_nsec ? -1 : 1;
+    return lx != ly ? (lx < ly ? -1 : 1) : strcmp(x->name, y->name);
+}
 
-    while (strlen(*dst) + strlen(src) >= new_size)
-        new_size *= 2;
+/*
+ * Remove the oldest files of the directory beyond clog->keep but
+ * active, logs are the names starting with the year
+ */
+static void
+_gpt_clog_retain(gpt_clog_t *clog, const char *active)
+{
+    DIR             *d;
+    struct dirent   *e;
+    struct stat      st;
+    struct clog_old *old = NULL, *p;
+    char             path[512];
+    size_t           n = 0, cap = 0, i;
+
+    if (clog->keep <= 0 || (d = opendir(clog->dir)) == NULL)
+        return;
+    while ((e = readdir(d)) != NULL) {
+        if (!isdigit((unsigned char)e->d_name[0]) || strcmp(e->d_name, active) == 0)
+            continue;
+        snprintf(path, sizeof(path), "%s%s", clog->dir, e->d_name);
+        if (stat(path, &st) == -1 || !S_ISREG(st.st_mode))
+            continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 16;
+            if ((p = (struct clog_old *)realloc(old, cap * sizeof(*old))) == NULL)
+                break;
+            old = p;
+        }
+        old[n].mtime = st.st_mtim;
+        snprintf(old[n].name, sizeof(old[n].name), "%s", e->d_name);
+        n++;
+    }
+    closedir(d);
 
-    if (new_size != cur_size) {
-        if (*dst == orig_buf) {
-            *dst = (char *)malloc(new_size);
-            strncpy(*dst, orig_buf, new_size);
-        } else {
-            *dst = (char *)realloc(*dst, new_size);
+    if (n > (size_t)clog->keep) {
+        qsort(old, n, sizeof(*old), _gpt_clog_oldest);
+        for (i = 0; i < n - clog->keep; i++) {
+            snprintf(path, sizeof(path), "%s%s", clog->dir, old[i].name);
+            unlink(path);
         }
     }
+    free(old);
+}
 
-    strcat(*dst, src);
-    return new_size;
+/*
+ * What a rollover leaves to do once the lock is released: the
+ * file to compress (empty for none) and the one now written
+ */
+struct clog_roll {
+    char    rolled[PATH_MAX];
+    char    active[PATH_MAX];
+};
+
+/*
+ * Whether name is in use, as it is or compressed
+ */
+static int
+_gpt_clog_taken(const char *name)
+{
+    struct stat st;
+    char        gz[PATH_MAX];
+
+    snprintf(gz, sizeof(gz), "%s.gz", name);
+    return stat(name, &st) == 0 || stat(gz, &st) == 0;
 }
 
-static size_t
-_gpt_clog_append_time(const gpt_clog_t *clog,
-                      char **dst, 
-                      char *orig_buf, 
-                      const char *fmt,
-                      size_t cur_size)
+/*
+ * Start a new file before len more bytes when the day is over or
+ * the file would pass maxsize: a full file is renamed to the next
+ * free "<day>.<n>", the one of a past day keeps its name. The new
+ * descriptor replaces the old one only once it is open, a failure
+ * keeps writing to the old file. Called under the lock or by the
+ * only writer, return 1 with roll filled in when a file was started.
+ */
+static int
+_gpt_clog_rotate(gpt_clog_t *clog, size_t len, struct clog_roll *roll)
 {
-    char    buf[256];
-    size_t  ret = 0;
-    char    *pbuf = NULL;
+    struct timespec ts;
+    char            rolled[sizeof(clog->filename) + 16];
+    int             fd;
+
+#ifdef CLOCK_REALTIME_COARSE
+    if (clock_gettime(CLOCK_REALTIME_COARSE, &ts) == -1)
+#endif
+        clock_gettime(CLOCK_REALTIME, &ts);
+    if (ts.tv_sec < clog->until && (clog->size == 0 || clog->size + len <= clog->maxsize))
+        return 0;
 
-    pbuf = _gpt_clog_time(clog, buf, sizeof(buf));
+    if (ts.tv_sec < clog->until) {
+        do {
+            snprintf(rolled, sizeof(rolled), "%s.%d", clog->filename, ++clog->seq);
+        } while (_gpt_clog_taken(rolled));
+        if (rename(clog->filename, rolled) == -1) {
+            _gpt_clog_err("(clog): rename() %s failed. %s\n", clog->filename, strerror(errno));
+            clog->size = 0;
+            return 0;
+        }
+    } else {
+        snprintf(rolled, sizeof(rolled), "%s", clog->filename);
+        clog->seq = 0;
+    }
 
-    if (pbuf != NULL)
-        return _gpt_clog_append_str(dst, orig_buf, pbuf, cur_size);
-    return cur_size;
+    if ((fd = _gpt_clog_open(clog, ts.tv_sec)) == -1) {
+        /* try again with the next file */
+        clog->size = 0;
+        return 0;
+    }
+    close(clog->fd);
+    clog->fd = fd;
+
+    roll->rolled[0] = '\0';
+    /* the clock went back across midnight, it is the same file */
+    if (clog->compress && strcmp(rolled, clog->filename) != 0)
+        snprintf(roll->rolled, sizeof(roll->rolled), "%s", rolled);
+    snprintf(roll->active, sizeof(roll->active), "%s", _gpt_clog_basename(clog->filename));
+    return 1;
 }
 
-static size_t
-_gpt_clog_append_int(char **dst, char *orig_buf, long int d, size_t cur_size)
+/*
+ * The slow part of a rollover, it forks and scans the
+ * directory so nobody waiting for the lock is held up
+ */
+static void
+_gpt_clog_tidy(gpt_clog_t *clog, const struct clog_roll *roll)
 {
-    char buf[40]; /* Enough for 128-bit decimal */
-
-    if (snprintf(buf, sizeof(buf), "%ld", d) >= 40)
-        return cur_size;
-    
-    return _gpt_clog_append_str(dst, orig_buf, buf, cur_size);
+    if (roll->rolled[0] != '\0')
+        _gpt_clog_compress(roll->rolled);
+    _gpt_clog_retain(clog, roll->active);
 }
 
+#endif
+
 /**
- * Set the format string for log messages.  Here are the substitutions you may
+ * Compile the format string for log messages into clog->ops, so a
+ * message only copies the pieces. Here are the substitutions you may
  * use:
  *
  *     %f: Source file name generating the log call.
  *     %n: Source line number where the log call was made.
  *     %m: The message text sent to the logger (after printf formatting).
  *     %d: The current date, formatted using the logger's date format.
- *     %t: The current time, formatted using the logger's time format.
+ *     %t: The current thread.
  *     %l: The log level (one of "DEBUG", "INFO", "WARN", or "ERROR").
  *     %%: A literal percent sign.
  *
- * The default format string is CLOG_DEFAULT_FORMAT.
+ * Unknown substitutions are dropped. The default format string
+ * is CLOG_DEFAULT_FORMAT. Return 0 if successful, otherwise -1
  * */
-static char *
-_gpt_clog_format(const gpt_clog_t *clog, 
-                char buf[],
-                size_t buf_size,
-                const char *sfile,
-                int sline, 
-                const char *level,
-                const char *message)
-{
-    size_t  i, fmtlen;
-    size_t  cur_size = buf_size;
-    char   *result = buf;
-    enum { NORMAL, SUBST } state = NORMAL;
-
-    fmtlen = strlen(clog->fmt);
-    sfile = _gpt_clog_basename(sfile);
-    result[0] = 0;
-    for (i = 0; i < fmtlen; ++i) {
-        if (state == NORMAL) {
-            if (clog->fmt[i] == '%') {
-                state = SUBST;
-            } else {
-                char str[2] = { 0 };
-                str[0] = clog->fmt[i];
-                cur_size = _gpt_clog_append_str(&result, buf, str, cur_size);
-            }
-        } else {
-            switch (clog->fmt[i]) {
-                case '%':
-                    cur_size = _gpt_clog_append_str(&result, buf, "%", cur_size);
-                    break;
-                case 't':
-                    cur_size = _gpt_clog_append_int(&result, buf, (long)pthread_self(), cur_size);
-                    break;
-                case 'd':
-                    cur_size = _gpt_clog_append_time(clog, &result, buf, clog->fmt, cur_size);
-                    break;
-                case 'l':
-                    cur_size = _gpt_clog_append_str(&result, buf, level, cur_size);
-                    break;
-                case 'n':
-                    cur_size = _gpt_clog_append_int(&result, buf, sline, cur_size);
-                    break;
-                case 'f':
-                    cur_size = _gpt_clog_append_str(&result, buf, sfile, cur_size);
-                    break;
-                case 'm':
-                    cur_size = _gpt_clog_append_str(&result, buf, message, cur_size);
-                    break;
+static int
+_gpt_clog_compile(gpt_clog_t *clog) {
+    struct clog_op *op = NULL;
+    const char     *f;
+    size_t          n = 0;
+    int             code;
+
+    clog->nops = 0;
+    for (f = clog->fmt; *f != '\0'; f++) {
+        if (*f == '%' && f[1] != '%') {
+            switch (*++f) {
+            case 'f': code = CLOG_OP_FILE; break;
+            case 'n': code = CLOG_OP_LINE; break;
+            case 'm': code = CLOG_OP_MSG; break;
+            case 'd': code = CLOG_OP_DATE; break;
+            case 't': code = CLOG_OP_THREAD; break;
+            case 'l': code = CLOG_OP_LEVEL; break;
+            case '\0': f--; /* fall through */
+            default: continue;
             }
-            state = NORMAL;
+            if (clog->nops == GPT_CLOG_OPS)
+                return -1;
+            op = &clog->ops[clog->nops++];
+            op->code = code;
+            continue;
+        }
+        /* literal text, "%%" keeps one percent sign */
+        if (*f == '%')
+            f++;
+        if (op == NULL || op->code != CLOG_OP_TEXT) {
+            if (clog->nops == GPT_CLOG_OPS)
+                return -1;
+            op = &clog->ops[clog->nops++];
+            op->code = CLOG_OP_TEXT;
+            op->off = n;
+            op->len = 0;
         }
+        clog->text[n++] = *f;
+        op->len++;
     }
-    return result;
+    return 0;
 }
 
-static void 
-_gpt_clog_write(const gpt_clog_t *clog,
-                clog_level level,
-                const char *sfile,
-                int sline,
-                const char *fmt,
-                va_list ap)
-{
-    int             result = 0;
-    char            buf[LOG_BUFF];
-    char           *dynbuf = buf;
-    char           *message;
-    size_t          size = LOG_BUFF;
-    va_list         ap_copy;
-    pthread_t       pid;
-    
-    //pid = pthread_self();
+/*
+ * Line being rendered, it starts in a buffer on the stack
+ * and moves to the heap only when it outgrows it
+ */
+struct clog_line {
+    char   *data;
+    size_t  len;
+    size_t  cap;
+    char   *heap;
+};
+
+static int
+_gpt_clog_room(struct clog_line *l, size_t n) {
+    size_t  cap;
+    char   *p;
+
+    if (l->len + n <= l->cap)
+        return 0;
+    for (cap = l->cap * 2; cap < l->len + n; cap *= 2)
+        ;
+    if ((p = (char *)realloc(l->heap, cap)) == NULL)
+        return -1;
+    if (l->heap == NULL)
+        memcpy(p, l->data, l->len);
+    l->data = l->heap = p;
+    l->cap = cap;
+    return 0;
+}
+
+static inline void
+_gpt_clog_text(struct clog_line *l, const char *s, size_t n) {
+    if (_gpt_clog_room(l, n) == 0) {
+        memcpy(l->data + l->len, s, n);
+        l->len += n;
+    }
+}
+
+static void
+_gpt_clog_long(struct clog_line *l, long d) {
+    char            buf[24];    /* Enough for 64-bit decimal */
+    char           *p = buf + sizeof(buf);
+    unsigned long   u = d < 0 ? 0UL - (unsigned long)d : (unsigned long)d;
+
+    do {
+        *--p = '0' + u % 10;
+    } while ((u /= 10) != 0);
+    if (d < 0)
+        *--p = '-';
+    _gpt_clog_text(l, p, buf + sizeof(buf) - p);
+}
+
+/*
+ * The message goes straight into the line, it is
+ * formatted a second time only if it did not fit
+ */
+static int
+_gpt_clog_message(struct clog_line *l, const char *fmt, va_list ap) {
+    va_list ap_copy;
+    size_t  room = l->cap - l->len;
+    int     n;
 
     va_copy(ap_copy, ap);
-    result = vsnprintf(dynbuf, size, fmt, ap);
-    if ((size_t)result >= size) {
-        size = result + 1;
-        dynbuf = (char *)calloc(1, size);
-        result = vsnprintf(dynbuf, size, fmt, ap_copy);
-        if ((size_t)result >= size) {
-            /* Formatting failed -- too large */
-            _gpt_clog_err("(clog): Formatting failed (1).\n");
-            va_end(ap_copy);
-            free(dynbuf);
-            return;
+    n = vsnprintf(l->data + l->len, room, fmt, ap_copy);
+    va_end(ap_copy);
+    if (n < 0)
+        return -1;
+    if ((size_t)n >= room) {
+        if (_gpt_clog_room(l, n + 1) == -1)
+            return -1;
+        va_copy(ap_copy, ap);
+        vsnprintf(l->data + l->len, n + 1, fmt, ap_copy);
+        va_end(ap_copy);
+    }
+    l->len += n;
+    return 0;
+}
+
+#ifdef __GPTCLOG__
+/* only a log file is written in the background */
+
+/*
+ * Write all of iov, a short write goes on from where it stopped
+ */
+static int
+_gpt_clog_writev(int fd, struct iovec *iov, int n) {
+    ssize_t w;
+
+    while (n > 0) {
+        if ((w = writev(fd, iov, n)) == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while (n > 0 && (size_t)w >= iov->iov_len) {
+            w -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= w;
         }
     }
-    va_end(ap_copy);
+    return 0;
+}
 
-    {
-        char msg[LOG_BUFF];
-        message = _gpt_clog_format(clog, msg, LOG_BUFF, 
-                                    sfile, sline, CLOG_LEVEL_NAMES[level], dynbuf);
-        if (!message) {
-            _gpt_clog_err("(clog): Formatting failed (2).\n");
-            if (dynbuf != buf)
-                free(dynbuf);
-            return;
+/*
+ * Claim the next position of the ring and publish the record there,
+ * a full ring holds the producer until the writer frees a slot
+ */
+static void
+_gpt_clog_push(gpt_clog_t *clog, const char *line, size_t len) {
+    struct clog_slot   *slot;
+    size_t              pos, seq;
+
+    pos = __atomic_load_n(&clog->head, __ATOMIC_RELAXED);
+    for (;;) {
+        slot = &clog->ring[pos & clog->mask];
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&clog->head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if ((ptrdiff_t)(seq - pos) < 0) {
+            /* full, the writer is a lap behind */
+            sched_yield();
+            pos = __atomic_load_n(&clog->head, __ATOMIC_RELAXED);
+        } else {
+            pos = __atomic_load_n(&clog->head, __ATOMIC_RELAXED);
         }
-        /*write log message to file*/
-#ifdef __GPTCLOG__
-        result = write(clog->fd, message, strlen(message));
-        if (result == -1)
+    }
+
+    slot->big = NULL;
+    if (len > sizeof(slot->data) && (slot->big = (char *)malloc(len)) != NULL)
+        memcpy(slot->big, line, len);
+    else
+        memcpy(slot->data, line, len = len > sizeof(slot->data) ? sizeof(slot->data) : len);
+    slot->len = len;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+    /* pairs with the writer announcing its sleep before it looks again */
+    if (__atomic_load_n(&clog->sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&clog->mutex);
+        pthread_cond_signal(&clog->wake);
+        pthread_mutex_unlock(&clog->mutex);
+    }
+}
+
+/*
+ * Background writer: takes the published records in order, up
+ * to GPT_CLOG_BATCH of them per writev, and sleeps when there
+ * are none. It leaves once stopped and the ring is drained.
+ */
+static void *
+_gpt_clog_writer(void *arg) {
+    gpt_clog_t         *clog = (gpt_clog_t *)arg;
+    struct clog_slot   *slot;
+    struct iovec        iov[GPT_CLOG_BATCH];
+    struct timespec     ts;
+    struct clog_roll    roll;
+    size_t              pos, len;
+    int                 i, n;
+
+    for (;;) {
+        pos = clog->tail;
+        for (n = 0; n < GPT_CLOG_BATCH; n++) {
+            slot = &clog->ring[(pos + n) & clog->mask];
+            if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + n + 1)
+                break;
+            iov[n].iov_base = slot->big ? slot->big : slot->data;
+            iov[n].iov_len = slot->len;
+        }
+
+        if (n == 0) {
+            if (__atomic_load_n(&clog->stop, __ATOMIC_ACQUIRE))
+                break;
+            pthread_mutex_lock(&clog->mutex);
+            __atomic_store_n(&clog->sleeping, 1, __ATOMIC_SEQ_CST);
+            slot = &clog->ring[pos & clog->mask];
+            if (__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) != pos + 1
+                && !__atomic_load_n(&clog->stop, __ATOMIC_SEQ_CST)) {
+                /* the timeout only bounds a wakeup that went missing */
+                clock_gettime(CLOCK_REALTIME, &ts);
+                if ((ts.tv_nsec += 100000000L) >= 1000000000L) {
+                    ts.tv_sec++;
+                    ts.tv_nsec -= 1000000000L;
+                }
+                pthread_cond_timedwait(&clog->wake, &clog->mutex, &ts);
+            }
+            __atomic_store_n(&clog->sleeping, 0, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&clog->mutex);
+            continue;
+        }
+
+        for (i = 0, len = 0; i < n; i++)
+            len += iov[i].iov_len;
+        if (_gpt_clog_rotate(clog, len, &roll) == 1)
+            _gpt_clog_tidy(clog, &roll);
+        if (_gpt_clog_writev(clog->fd, iov, n) == -1)
             _gpt_clog_err("(clog): Unable to write to log file: %s\n", strerror(errno));
+        clog->size += len;
+        for (i = 0; i < n; i++) {
+            slot = &clog->ring[(pos + i) & clog->mask];
+            free(slot->big);
+            slot->big = NULL;
+            __atomic_store_n(&slot->seq, pos + i + clog->mask + 1, __ATOMIC_RELEASE);
+        }
+        clog->tail = pos + n;
+    }
+    return NULL;
+}
+
+#endif
+
+/*
+ * Hand the finished line to the ring, or write it in place
+ */
+static void
+_gpt_clog_put(gpt_clog_t *clog, const char *line, size_t len) {
+#ifdef __GPTCLOG__
+    struct clog_roll    roll;
+    int                 rolled;
+
+    if (clog->ring != NULL) {
+        _gpt_clog_push(clog, line, len);
+        return;
+    }
+    /* O_APPEND keeps a single write whole, the lock keeps the fd */
+    pthread_mutex_lock(&clog->mutex);
+    rolled = _gpt_clog_rotate(clog, len, &roll);
+    if (write(clog->fd, line, len) == -1)
+        _gpt_clog_err("(clog): Unable to write to log file: %s\n", strerror(errno));
+    clog->size += len;
+    pthread_mutex_unlock(&clog->mutex);
+    if (rolled)
+        _gpt_clog_tidy(clog, &roll);
 #else
-        _gpt_clog_err("(clog): %s", message);
+    (void)clog;
+    _gpt_clog_err("(clog): %.*s", (int)len, line);
 #endif
-        if (message != msg) {
-            free(message);
-        }
-        if (dynbuf != buf) {
-            free(dynbuf);
+}
+
+static void 
+_gpt_clog_write(gpt_clog_t *clog,
+                clog_level level,
+                const char *sfile,
+                int sline,
+                const char *fmt,
+                va_list ap)
+{
+    char                buf[LOG_BUFF];
+    char                timestamp[64];
+    struct clog_line    line = {buf, 0, sizeof(buf), NULL};
+    const struct clog_op *op;
+    int                 i;
+
+    for (i = 0; i < clog->nops; i++) {
+        op = &clog->ops[i];
+        switch (op->code) {
+        case CLOG_OP_TEXT:
+            _gpt_clog_text(&line, clog->text + op->off, op->len);
+            break;
+        case CLOG_OP_FILE:
+            sfile = _gpt_clog_basename(sfile);
+            _gpt_clog_text(&line, sfile, strlen(sfile));
+            break;
+        case CLOG_OP_LINE:
+            _gpt_clog_long(&line, sline);
+            break;
+        case CLOG_OP_MSG:
+            if (_gpt_clog_message(&line, fmt, ap) == -1) {
+                /* Formatting failed -- too large */
+                _gpt_clog_err("(clog): Formatting failed (1).\n");
+                free(line.heap);
+                return;
+            }
+            break;
+        case CLOG_OP_DATE:
+            _gpt_clog_time(clog, timestamp, sizeof(timestamp));
+            _gpt_clog_text(&line, timestamp, strlen(timestamp));
+            break;
+        case CLOG_OP_THREAD:
+            _gpt_clog_long(&line, (long)pthread_self());
+            break;
+        case CLOG_OP_LEVEL:
+            _gpt_clog_text(&line, CLOG_LEVEL_NAMES[level], CLOG_LEVEL_LENS[level]);
+            break;
         }
     }
+    /* write log message to file */
+    _gpt_clog_put(clog, line.data, line.len);
+    free(line.heap);
 }
 
+/*
+ * The message is formatted by the calling thread without
+ * any lock, only writing it out is serialized
+ */
 void
 gpt_clog_info(gpt_clog_t *clog,
             clog_level level,
@@ -264,22 +638,27 @@ gpt_clog_info(gpt_clog_t *clog,
             int sline, 
             const char *fmt, ...)
 {
-    pthread_mutex_lock(&clog->mutex);
     va_list ap;
+
+    /* dropped before any formatting */
+    if (level < __atomic_load_n(&clog->level, __ATOMIC_RELAXED))
+        return;
     va_start(ap, fmt);
     _gpt_clog_write(clog, level, sfile, sline, fmt, ap);
     va_end(ap);
-    pthread_mutex_unlock(&clog->mutex);
 }
 
 /*
  * create clog object, path is log file path eg.
  * ./log, /log or ./log/
- * Create the directory if it does not exist
+ * Create the directory if it does not exist. A file
+ * rolls over at maxsize KB (0 for MAXFILESIZE) or
+ * at midnight, whichever comes first
  */
 gpt_clog_t *
 gpt_clog_creat(const char *path, uint64_t maxsize) {
     gpt_clog_t *logger = NULL;
+    char       *dir;
 
     if (path == NULL) {
         assert(0 && "(clog): log filename equal NULL");
@@ -299,11 +678,22 @@ gpt_clog_creat(const char *path, uint64_t maxsize) {
 
     if ((logger = (gpt_clog_t *)calloc(1, sizeof(*logger))) == NULL)
         goto err;
-    _gpt_clog_filename(logger->filename, sizeof(logger->filename), path);
+    if ((dir = path_normalize(path)) == NULL) {
+        _gpt_clog_err("(clog): path normalize faild.\n");
+        goto err;
+    }
+    // stitching path
+    snprintf(logger->dir, sizeof(logger->dir), "%s%s", dir,
+             dir[0] != '\0' && dir[strlen(dir) - 1] == '/' ? "" : "/");
+    free(dir);
+    logger->maxsize = maxsize > 0 ? maxsize * 1024 : MAXFILESIZE;
+    logger->keep = GPT_CLOG_KEEP;
 
     logger->level = CLOG_DEBUG;
     logger->tfmt = gf_timefmt_bdT;
     strncpy(logger->fmt, CLOG_DEFAULT_FORMAT, sizeof(logger->fmt));
+    if (_gpt_clog_compile(logger) == -1)
+        goto err;
     /*
      * A mutex variable is represented by the pthread_mutex_t data type. Before we
      * can use a mutex variable, we must first initialize it by either setting it to the constant
@@ -313,15 +703,8 @@ gpt_clog_creat(const char *path, uint64_t maxsize) {
     if (pthread_mutex_init(&logger->mutex, NULL) != 0)
         goto err;
 
-    /*
-     * The open() system call opens the file specified by pathname.  
-     * If the specified file does not exist, it may op‐tionally 
-     * (if O_CREAT is specified in flags) be created by open().
-     */
-    if((logger->fd = open(logger->filename, O_CREAT | O_WRONLY | O_APPEND, 0666)) == -1) {
-        _gpt_clog_err("(clog): open() %s function failed.\n", logger->filename, strerror(errno));
+    if ((logger->fd = _gpt_clog_open(logger, time(NULL))) == -1)
         goto err;
-    }
 
     return logger;
 err:
@@ -330,10 +713,65 @@ err:
     return NULL;
 }
 
+void
+gpt_clog_level(gpt_clog_t *clog, clog_level level) {
+    __atomic_store_n(&clog->level, level, __ATOMIC_RELAXED);
+}
+
+void
+gpt_clog_keep(gpt_clog_t *clog, int files, int compress) {
+    clog->keep = files;
+    clog->compress = compress;
+}
+
+int
+gpt_clog_async(gpt_clog_t *clog, size_t slots) {
+#ifdef __GPTCLOG__
+    size_t  n, i;
+    int     rc;
+
+    if (clog->ring != NULL)
+        return 0;
+    for (n = 2; n < slots; n <<= 1)
+        ;
+    if ((clog->ring = (struct clog_slot *)calloc(n, sizeof(*clog->ring))) == NULL)
+        return -1;
+    for (i = 0; i < n; i++)
+        clog->ring[i].seq = i;
+    clog->mask = n - 1;
+    clog->head = clog->tail = 0;
+    clog->stop = clog->sleeping = 0;
+
+    if ((rc = pthread_cond_init(&clog->wake, NULL)) != 0
+        || (rc = pthread_create(&clog->writer, NULL, _gpt_clog_writer, clog)) != 0) {
+        free(clog->ring);
+        clog->ring = NULL;
+        errno = rc;
+        return -1;
+    }
+#else
+    /* messages go to stderr in place, next to the console output */
+    (void)clog;
+    (void)slots;
+#endif
+    return 0;
+}
+
 void
 gpt_clog_close(gpt_clog_t *clog) {
     if (clog == NULL)
         return;
+
+    if (clog->ring != NULL) {
+        pthread_mutex_lock(&clog->mutex);
+        __atomic_store_n(&clog->stop, 1, __ATOMIC_SEQ_CST);
+        pthread_cond_signal(&clog->wake);
+        pthread_mutex_unlock(&clog->mutex);
+        pthread_join(clog->writer, NULL);
+        pthread_cond_destroy(&clog->wake);
+        free(clog->ring);
+        clog->ring = NULL;
+    }
     
     pthread_mutex_lock(&clog->mutex);
     pthread_mutex_unlock(&clog->mutex);
@@ -341,4 +779,4 @@ gpt_clog_close(gpt_clog_t *clog) {
 
     close(clog->fd);
     free(clog);
-}
\ No newline at end of file
+}
@@ -18,33 +18,152 @@ typedef enum clog_level {
     CLOG_FATAL
 } clog_level;
 
+#define GPT_CLOG_SLOTS      1024    /* records the ring of the async writer holds */
+#define GPT_CLOG_SLOT       512     /* bytes a record keeps in its slot, longer ones are copied */
+#define GPT_CLOG_BATCH      64      /* records one writev takes at most */
+
+#define GPT_CLOG_KEEP       7       /* rolled over files kept by default */
+#define GPT_CLOG_OPS        32      /* pieces a compiled format may have */
+
+/*
+ * Piece of the compiled format: literal text at off in
+ * clog->text or one of the substitutions
+ */
+enum clog_opcode {
+    CLOG_OP_TEXT,
+    CLOG_OP_FILE,
+    CLOG_OP_LINE,
+    CLOG_OP_MSG,
+    CLOG_OP_DATE,
+    CLOG_OP_THREAD,
+    CLOG_OP_LEVEL
+};
+
+struct clog_op {
+    unsigned char   code;
+    unsigned char   off;
+    unsigned char   len;
+};
+
+/*
+ * A record in the ring, seq tells who owns it: pos for the
+ * producer claiming position pos, pos + 1 once it is published
+ * and pos + slots again after the writer is done with it
+ */
+struct clog_slot {
+    size_t          seq;
+    size_t          len;
+    char           *big;            /* record longer than data, NULL if it fits */
+    char            data[GPT_CLOG_SLOT];
+};
+
 struct clog {
     enum clog_level level;          /* The current level of this logger. 
                                      * Messages below it will be dropped. */
     int             fd;             /* log file handle*/
     char            filename[256];  /* log file name*/
+    char            dir[256];       /* log directory, ends with a slash */
+    uint64_t        maxsize;        /* bytes a file may take before it rolls over */
+    uint64_t        size;           /* bytes of the current file */
+    time_t          until;          /* start of the next day, it gets a new file */
+    int             seq;            /* last ".<n>" of a file rolled over today */
+    int             keep;           /* files kept next to the current one, 0 keeps all */
+    int             compress;       /* gzip the files rolled over */
     pthread_mutex_t mutex;          /* A mutex variable is represented by 
                                      * the pthread_mutex_t data type.*/
     char            fmt[256];       /* %f: Source file name generating the log call.
                                      * %n: Source line number where the log call was made.
                                      * %m: The message text sent to the logger (after printf formatting).
                                      * %d: The current date, formatted using the logger's date format.
-                                     * %t: The current time, formatted using the logger's time format.
+                                     * %t: The current thread.
                                      * %l: The log level (one of "DEBUG", "INFO", "WARN", or "ERROR").
                                      * %%: A literal percent sign.*/
     unsigned int    tfmt;           /* Time format */
+    struct clog_op  ops[GPT_CLOG_OPS]; /* fmt compiled by gpt_clog_creat */
+    int             nops;
+    char            text[256];      /* literal text of the ops */
+
+    /* async mode, ring is NULL while messages are written in place */
+    struct clog_slot *ring;
+    size_t          mask;           /* slots - 1, a power of two */
+    size_t          head;           /* next position producers claim */
+    size_t          tail;           /* next position the writer takes */
+    int             sleeping;       /* the writer waits on wake */
+    int             stop;
+    pthread_t       writer;
+    pthread_cond_t  wake;
 };
 
 gpt_clog_t *gpt_clog_creat(const char *filename, uint64_t maxsize);
+/*
+ * Keep at most files logs besides the current one, 0 keeps
+ * them all, and gzip them in the background if compress is set
+ */
+void gpt_clog_keep(gpt_clog_t *clog, int files, int compress);
+/*
+ * Hand the writes to a background thread: producers only copy their
+ * record into a lock-free ring of at least slots records, the thread
+ * writes them out in batches. Return 0 if successful, otherwise -1
+ */
+int gpt_clog_async(gpt_clog_t *clog, size_t slots);
+/*
+ * Write out what the ring still holds and release the logger
+ */
 void gpt_clog_close(gpt_clog_t *clog);
 void gpt_clog_info(gpt_clog_t *clog, clog_level level,
                 const char *sfile, int sline, const char *fmt, ...) __attribute__((format(printf, 5, 6)));
 
-#define GCLOG_TRACE(clog, fmt, ...) gpt_clog_info(clog, CLOG_TRACE, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define GCLOG_DEBUG(clog, fmt, ...) gpt_clog_info(clog, CLOG_DEBUG, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define GCLOG_INFO(clog, fmt, ...) gpt_clog_info(clog, CLOG_INFO, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define GCLOG_WARN(clog, fmt, ...) gpt_clog_info(clog, CLOG_WARN, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define GCLOG_ERROR(clog, fmt, ...) gpt_clog_info(clog, CLOG_ERROR, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define GCLOG_FATAL(clog, fmt, ...) gpt_clog_info(clog, CLOG_FATAL, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
+/*
+ * Set the level messages below which are dropped
+ */
+void gpt_clog_level(gpt_clog_t *clog, clog_level level);
+
+/*
+ * Calls below GPT_CLOG_LEVEL (0 TRACE ... 5 FATAL, -DCLOG_LEVEL= at
+ * compile time) are compiled out, their arguments are still type
+ * checked but never evaluated. The others check the level of the
+ * logger before anything is formatted.
+ */
+#ifndef GPT_CLOG_LEVEL
+#define GPT_CLOG_LEVEL      0
+#endif
+
+#define GCLOG_ON(clog, lv, fmt, ...)                                            \
+    do {                                                                        \
+        if ((clog) != NULL && (lv) >= __atomic_load_n(&(clog)->level, __ATOMIC_RELAXED)) \
+            gpt_clog_info(clog, lv, __FILE__, __LINE__, fmt, ##__VA_ARGS__);    \
+    } while (0)
+#define GCLOG_OFF(clog, lv, fmt, ...)                                           \
+    do {                                                                        \
+        if (0)                                                                  \
+            gpt_clog_info(clog, lv, __FILE__, __LINE__, fmt, ##__VA_ARGS__);    \
+    } while (0)
+
+#if GPT_CLOG_LEVEL <= 0
+#define GCLOG_TRACE(clog, fmt, ...) GCLOG_ON(clog, CLOG_TRACE, fmt, ##__VA_ARGS__)
+#else
+#define GCLOG_TRACE(clog, fmt, ...) GCLOG_OFF(clog, CLOG_TRACE, fmt, ##__VA_ARGS__)
+#endif
+#if GPT_CLOG_LEVEL <= 1
+#define GCLOG_DEBUG(clog, fmt, ...) GCLOG_ON(clog, CLOG_DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define GCLOG_DEBUG(clog, fmt, ...) GCLOG_OFF(clog, CLOG_DEBUG, fmt, ##__VA_ARGS__)
+#endif
+#if GPT_CLOG_LEVEL <= 2
+#define GCLOG_INFO(clog, fmt, ...) GCLOG_ON(clog, CLOG_INFO, fmt, ##__VA_ARGS__)
+#else
+#define GCLOG_INFO(clog, fmt, ...) GCLOG_OFF(clog, CLOG_INFO, fmt, ##__VA_ARGS__)
+#endif
+#if GPT_CLOG_LEVEL <= 3
+#define GCLOG_WARN(clog, fmt, ...) GCLOG_ON(clog, CLOG_WARN, fmt, ##__VA_ARGS__)
+#else
+#define GCLOG_WARN(clog, fmt, ...) GCLOG_OFF(clog, CLOG_WARN, fmt, ##__VA_ARGS__)
+#endif
+#if GPT_CLOG_LEVEL <= 4
+#define GCLOG_ERROR(clog, fmt, ...) GCLOG_ON(clog, CLOG_ERROR, fmt, ##__VA_ARGS__)
+#else
+#define GCLOG_ERROR(clog, fmt, ...) GCLOG_OFF(clog, CLOG_ERROR, fmt, ##__VA_ARGS__)
+#endif
+#define GCLOG_FATAL(clog, fmt, ...) GCLOG_ON(clog, CLOG_FATAL, fmt, ##__VA_ARGS__)
 
 #endif
\ No newline at end of file
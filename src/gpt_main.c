@@ -2,6 +2,7 @@
  * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
  */
 #include <gpt_config.h>
+#include <sys/signalfd.h>
 
 static const char usage[]
     = "\n"
@@ -39,9 +40,32 @@ static const char helpusage[]
 	  "      -k <key>   : API key generated by the ChatGPT official website.\n"
 	  "      -f <file>  : JSON configuration file settings.\n"
       "      --url      : http URL (eg. https://api.openai.com/v1/chat/completions).\n"
-	  "      --timeout  : Set curl connection timeout (default 10).\n"
+	  "      --timeout  : Set connection timeout in seconds (default 10).\n"
+	  "      --keepalive: Seconds an idle connection is kept for reuse (default 30, 0 disables).\n"
+	  "      -s         : Stream the reply, print it while it is generated.\n"
+	  "      --cps      : Typewriter effect, characters per second (default 0, off).\n"
+	  "      --system   : System message sent first in every request.\n"
+	  "      --context  : Context window in tokens, older turns are dropped to fit (default 4096).\n"
+	  "      --vocab    : Token ranks file (cl100k_base.tiktoken) for exact token counts.\n"
+	  "      --batch    : Run every line of a file (- for stdin) as a prompt, no console.\n"
+	  "      --out      : Write batch results to a file instead of stdout.\n"
+	  "      --jobs     : Batch or server requests in flight at once (default 4).\n"
+	  "      --retries  : Retries of rate limited or failed requests (default 3).\n"
+	  "      --rpm      : Batch requests per minute allowed by the key (default 0, no limit).\n"
+	  "      --tpm      : Batch tokens per minute allowed by the key (default 0, no limit).\n"
+	  "      --cache    : Directory of cached replies, identical requests are not sent again.\n"
+	  "      --cache-size: Megabytes the cache may take (default 64).\n"
+	  "      --serve    : Serve /v1/chat/completions to other programs on unix:/path,\n"
+	  "                   host:port or a loopback port, no console. Clients use\n"
+	  "                   --url unix:/path (or http://host:port/v1/chat/completions).\n"
+	  "                   Requests go out with your key: other hosts are refused.\n"
+	  "      --serve-any: Let --serve listen on any address, anyone reaching it uses your key.\n"
 	  "      -v         : Displays version.\n"
 	  "      -h <help>  : Displays this usage screen.\n"
+	  "\n"
+	  "  commands:\n"
+	  "\n"
+	  "      /clear     : Forget the conversation and start a new one.\n"
 	  "\n";
 
 char *gpt_cmd_prompt = NULL;
@@ -51,23 +75,360 @@ static gpt_option_t opt = {
     .proxy = NULL,
     .url = NULL,
     .timeout = 0,
+    .keepalive = -1,
+    .stream = 0,
+    .cps = 0,
+    .system = NULL,
+    .context = GPT_CONTEXT,
+    .vocab = NULL,
+    .batch = NULL,
+    .out = NULL,
+    .jobs = GPT_BATCH_JOBS,
+    .retries = GPT_RETRY_MAX,
+    .cachesize = GPT_CACHE_SIZE,
     .clog = NULL,
 };
 
 static void gpt_do_completion(char const *prefix, linenoiseCompletions* lc);
 static char *gpt_do_hints(const char *buf, int *color, int *bold);
-static char *gpt_request_data(char **request, int n);
-static void gpt_request_free(gpt_request_t *rq, int n);
+static int gpt_request_data(gpt_conv_t *conv, gpt_buf_t *b);
 static char *gpt_request_cmd(const char *content);
-static FILE *gpt_request_send(const char *cmdline);
-static void gpt_response_parser(FILE *fp);
+static gpt_call_t *gpt_request_start(const gpt_buf_t *req, gpt_sse_t *sse, long tokens,
+                                     void (*done)(gpt_call_t *call), void *arg);
+static void gpt_response_delta(void *arg, const char *data, size_t len);
+static int gpt_response_parser(char *buf, size_t len);
+static void gpt_request_clear();
+
+/*
+ * Write to the terminal as it is, the prompt is not touched
+ */
+static void
+gpt_console_write(const char *s, size_t len) {
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = write(STDOUT_FILENO, s, len)) == -1) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        s += n;
+        len -= n;
+    }
+}
+
+/*
+ * Output of the reply while the prompt is on the screen: the prompt
+ * is taken down, the text goes on where the reply left off and the
+ * prompt comes back on the line below it
+ */
+static void
+gpt_console_out(void *arg, const char *s, size_t len) {
+    gpt_console_t  *con = (gpt_console_t *)arg;
+    int             cols = con->ls.cols > 0 ? (int)con->ls.cols : 80;
+    char            seq[32];
+
+    if (con->editing) {
+        linenoiseHide(&con->ls);
+        if (__fpending(stdout) > 0) {
+            /* a message came in between, the reply goes on below it */
+            fflush(stdout);
+            con->col = 0;
+        } else if (con->col > 0) {
+            snprintf(seq, sizeof(seq), "\x1b[1A\x1b[%dC", con->col);
+            gpt_console_write(seq, strlen(seq));
+        }
+    }
+    gpt_console_write(s, len);
+
+    /* columns are counted in UTF-8 characters, a full line wraps */
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '\n' || s[i] == '\r') {
+            con->col = 0;
+        } else if (s[i] == '\t') {
+            con->col = con->col / 8 * 8 + 8 < cols ? con->col / 8 * 8 + 8 : cols;
+        } else if ((s[i] & 0xC0) != 0x80) {
+            if (con->col == cols)
+                con->col = 0;
+            con->col++;
+        }
+    }
+
+    if (con->editing) {
+        if (con->col > 0) {
+            gpt_console_write("\r\n", 2);
+            if (con->col == cols)
+                con->col = 0;
+        }
+        linenoiseShow(&con->ls);
+    }
+}
+
+/*
+ * Whatever printf() left in stdio goes out above the prompt
+ */
+static void
+gpt_console_flush(gpt_console_t *con) {
+    if (__fpending(stdout) == 0)
+        return;
+    if (!con->editing) {
+        fflush(stdout);
+        return;
+    }
+    linenoiseHide(&con->ls);
+    fflush(stdout);
+    con->col = 0;
+    linenoiseShow(&con->ls);
+}
+
+/*
+ * Put a new prompt on the screen and take keys from the loop
+ */
+static void
+gpt_console_edit(gpt_console_t *con) {
+    struct termios  t;
+
+    fflush(stdout);
+    if (linenoiseEditStart(&con->ls, STDIN_FILENO, STDOUT_FILENO,
+                           con->buf, sizeof(con->buf), gpt_cmd_prompt) == -1) {
+        con->quit = 1;
+        return;
+    }
+    /* raw mode turns output processing off, the reply and printf() need their \r */
+    if (tcgetattr(STDIN_FILENO, &t) == 0) {
+        t.c_oflag |= OPOST;
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &t);
+    }
+    con->editing = 1;
+}
+
+static void
+gpt_console_stop(gpt_console_t *con) {
+    if (!con->editing)
+        return;
+    linenoiseEditStop(&con->ls);
+    fflush(stdout);
+    con->editing = 0;
+    /* the reply goes on below the line just typed */
+    con->col = 0;
+}
+
+static void gpt_console_next(gpt_console_t *con);
+
+/*
+ * SIGINT goes to the loop while a prompt is busy, on an
+ * idle prompt it quits as it always did
+ */
+static void
+gpt_console_sigint(gpt_console_t *con, int busy) {
+    struct signalfd_siginfo si;
+    sigset_t                mask;
+
+    if (con->sigfd == -1)
+        return;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    if (!busy) {
+        /* one that came too late for the request is dropped */
+        while (read(con->sigfd, &si, sizeof(si)) == sizeof(si))
+            ;
+    }
+    sigprocmask(busy ? SIG_BLOCK : SIG_UNBLOCK, &mask, NULL);
+}
+
+/*
+ * The prompt is over, a prompt without an answer
+ * is not part of the conversation
+ */
+static void
+gpt_console_finish(gpt_console_t *con, int replied) {
+    if (!replied)
+        gpt_conv_pop(opt.conv);
+    gpt_arena_hooks(NULL);
+    gpt_arena_reset(opt.arena);
+    con->call = NULL;
+    con->busy = 0;
+    gpt_console_sigint(con, 0);
+    gpt_console_next(con);
+}
+
+static void
+gpt_console_done(gpt_call_t *call) {
+    gpt_console_t  *con = (gpt_console_t *)call->arg;
+    int             replied = 0;
+
+    /*
+     * Streamed replies are already on the screen, anything
+     * else (including errors to a stream request) is parsed
+     * from the whole body.
+     */
+    if (con->sse.events > 0) {
+        if (con->text.len > 0)
+            gpt_render_end(&opt.render);
+        replied = call->rc == 0 && con->text.len > 0
+            && gpt_conv_append(opt.conv, "assistant", con->text.data, con->text.len) == 0;
+    } else if (call->rc == 0 && call->rsp.body.len > 0) {
+        /* the parser takes the buffer over */
+        replied = gpt_response_parser(call->rsp.body.data, call->rsp.body.len) == 0;
+        memset(&call->rsp.body, 0, sizeof(call->rsp.body));
+    }
+    gpt_call_free(call);
+    gpt_console_finish(con, replied);
+}
+
+/*
+ * Stop the reply being generated: its connection is closed (the
+ * others stay in the pool) or its curl child killed, the prompt
+ * is taken out of the conversation
+ */
+static void
+gpt_console_cancel(gpt_console_t *con) {
+    gpt_call_free(con->call);
+    if (con->text.len > 0) {
+        gpt_render_abort(&opt.render);
+        gpt_render_end(&opt.render);
+    }
+    printf("(cgpt): canceled\n");
+    gpt_console_finish(con, 0);
+}
+
+static void
+gpt_console_signal(gpt_io_t *io, int events) {
+    gpt_console_t          *con = (gpt_console_t *)io->arg;
+    struct signalfd_siginfo si;
+
+    while (read(io->fd, &si, sizeof(si)) == sizeof(si)) {
+        if (con->busy)
+            gpt_console_cancel(con);
+    }
+}
+
+/*
+ * Send the conversation with line as the new user turn
+ */
+static void
+gpt_console_ask(gpt_console_t *con, const char *line) {
+    gpt_call_t *call;
+
+    if (gpt_conv_append(opt.conv, "user", line, strlen(line)) == -1)
+        return;
+    /* the oldest turns make room when the window is full */
+    if (gpt_conv_trim(opt.conv, opt.context - GPT_CONTEXT_REPLY) == -1) {
+        printf("(cgpt): prompt is too long for a %ld token context\n", opt.context);
+        gpt_conv_pop(opt.conv);
+        return;
+    }
+    /*
+     * Small allocations of this request (cJSON nodes of
+     * streamed deltas) come from the arena and go away in
+     * one reset, the request body buffer is reused
+     */
+    gpt_arena_hooks(opt.arena);
+    gpt_buf_reset(&con->req);
+    gpt_buf_reset(&con->text);
+    con->sse.events = 0;
+    con->sse.on_event = gpt_response_delta;
+    con->sse.arg = &con->text;
+    con->busy = 1;
+    gpt_console_sigint(con, 1);
+    if (gpt_request_data(opt.conv, &con->req) == 0
+        && (call = gpt_request_start(&con->req, opt.stream ? &con->sse : NULL, 0,
+                                     gpt_console_done, con)) != NULL) {
+        /* done may already have run */
+        if (con->busy)
+            con->call = call;
+        return;
+    }
+    gpt_console_finish(con, 0);
+}
+
+static void
+gpt_console_run(gpt_console_t *con, const char *line) {
+    if (line[0] != '\0' && line[0] != '/') {
+        gpt_console_ask(con, line);
+    } else if (strcmp(line, "/clear") == 0) {
+        gpt_conv_clear(opt.conv);
+        printf("Conversation cleared.\n");
+    } else if (line[0] == '/') {
+        printf("Unreconized command: %s\n", line);
+    }
+}
+
+/*
+ * Run the lines typed so far, one prompt at a time
+ */
+static void
+gpt_console_next(gpt_console_t *con) {
+    struct console_line *cl;
+
+    if (con->running)
+        return;
+    con->running = 1;
+    while (!con->busy && (cl = con->head) != NULL) {
+        if ((con->head = cl->next) == NULL)
+            con->tail = NULL;
+        gpt_console_run(con, cl->line);
+        free(cl);
+    }
+    con->running = 0;
+}
+
+/*
+ * A line was entered, it waits behind the prompt still being answered
+ */
+static void
+gpt_console_submit(gpt_console_t *con, char *line) {
+    struct console_line *cl;
+    size_t               len = strlen(line);
+
+    if (line[0] != '\0' && line[0] != '/')
+        linenoiseHistoryAdd(line);
+    if ((cl = (struct console_line *)malloc(sizeof(*cl) + len + 1)) != NULL) {
+        cl->next = NULL;
+        memcpy(cl->line, line, len + 1);
+        if (con->tail != NULL)
+            con->tail->next = cl;
+        else
+            con->head = cl;
+        con->tail = cl;
+    }
+    linenoiseFree(line);
+    gpt_console_next(con);
+}
+
+/*
+ * A key was pressed
+ */
+static void
+gpt_console_input(gpt_io_t *io, int events) {
+    gpt_console_t  *con = (gpt_console_t *)io->arg;
+    char           *line;
+
+    errno = 0;
+    if ((line = linenoiseEditFeed(&con->ls)) == linenoiseEditMore)
+        return;
+    gpt_console_stop(con);
+
+    if (line != NULL) {
+        gpt_console_submit(con, line);
+    } else if (errno == EAGAIN && con->busy) {
+        /* Ctrl-C stops the reply, on an idle prompt it quits */
+        gpt_console_cancel(con);
+    } else {
+        if (con->busy)
+            gpt_console_cancel(con);
+        con->quit = 1;
+    }
+    if (!con->quit)
+        gpt_console_edit(con);
+}
 
 void
 gpt_console_loop() {
-    int              status;
+    gpt_console_t   *con = &opt.console;
     char            *line = NULL;
-    FILE            *fp;
-    gpt_object_t    *oj;
+    struct console_line *cl;
+    sigset_t         mask;
     gpt_cmd_prompt   = gpt_prompt;
     
     /* Parse options, with we enable multi line editing. */
@@ -81,52 +442,196 @@ gpt_console_loop() {
      * where entries are separated by newlines. */
     linenoiseHistoryLoad("history.txt"); /* Load the history at startup */
 
-    /* Now this is the main loop of the typical linenoise-based application.
-     * The call to linenoise() will block as long as the user types something
-     * and presses enter.
-     *
-     * The typed string is returned as a malloc() allocated string by
-     * linenoise, so the user needs to free() it. */
-    while (1) {
-        line = linenoise(gpt_cmd_prompt);
-        if (line == NULL)
-            break;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    if ((con->sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) != -1
+        && gpt_loop_add(opt.loop, &con->sig, con->sigfd, GPT_EV_READ,
+                        gpt_console_signal, con) == -1) {
+        close(con->sigfd);
+        con->sigfd = -1;
+    }
 
-        if (line[0] != '\0' && line[0] != '/') {
-            /* Add to the history. */
-            linenoiseHistoryAdd(line);
-            char *str = gpt_request_data(&line, 1);
-            // build command
-            char *cmd = gpt_request_cmd(str);
-            free(str);
-            // Start sending the request and parse the data
-            if (cmd != NULL) {
-                fp = gpt_request_send(cmd);
-                //fp = fopen("log.json", "rb");
-                if (fp != NULL) {
-                    gpt_response_parser(fp);
-                    free(cmd);
-                    clearerr(fp);
-
-                    if ((status = pclose(fp)) == -1) {
-                        printf("(clog): pclose %s\n", strerror(errno));
-                    }
-                    
-                    if (WIFEXITED(status)) {
-                        //printf("(clog): Exited with status %d\n", WEXITSTATUS(status));
-                    } else {
-                        printf("(clog): Exited abnormally.\n");
-                    }
+    if (isatty(STDIN_FILENO) && isatty(STDOUT_FILENO)
+        && gpt_loop_add(opt.loop, &con->in, STDIN_FILENO, GPT_EV_READ,
+                        gpt_console_input, con) == 0) {
+        /*
+         * Keys are read on the loop next to the reply, stdio is
+         * held back until the prompt is out of the way.
+         */
+        fflush(stdout);
+        setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
+        opt.render.out = gpt_console_out;
+        opt.render.arg = con;
+        gpt_console_edit(con);
+        while (!con->quit) {
+            if (gpt_loop_once(opt.loop, -1) == -1)
+                break;
+            gpt_console_flush(con);
+        }
+        gpt_console_stop(con);
+        gpt_loop_del(opt.loop, &con->in);
+        opt.render.out = NULL;
+        fflush(stdout);
+        setvbuf(stdout, NULL, _IOLBF, BUFSIZ);
+    } else {
+        /* Now this is the main loop of the typical linenoise-based application.
+         * The call to linenoise() will block as long as the user types something
+         * and presses enter.
+         *
+         * The typed string is returned as a malloc() allocated string by
+         * linenoise, so the user needs to free() it. */
+        while (!con->quit && (line = linenoise(gpt_cmd_prompt)) != NULL) {
+            gpt_console_submit(con, line);
+            while (con->busy || opt.render.armed) {
+                if (gpt_loop_once(opt.loop, -1) == -1) {
+                    con->quit = 1;
+                    break;
                 }
             }
-        } else if (line[0] == '/') {
-            printf("Unreconized command: %s\n", line);
+            fflush(stdout);
         }
-        linenoiseFree(line);
     }
+    /* the typewriter finishes the last reply */
+    while (opt.render.armed && gpt_loop_once(opt.loop, -1) != -1)
+        ;
+    while ((cl = con->head) != NULL) {
+        con->head = cl->next;
+        free(cl);
+    }
+    con->tail = NULL;
+    if (con->sigfd != -1) {
+        gpt_loop_del(opt.loop, &con->sig);
+        close(con->sigfd);
+        con->sigfd = -1;
+    }
+    gpt_buf_free(&con->req);
+    gpt_buf_free(&con->text);
+    gpt_sse_free(&con->sse);
     linenoiseHistorySave("history.txt");
 }
 
+/*
+ * Run the prompts of opt.batch instead of the console,
+ * results go to opt.out (stdout if not set)
+ */
+static int
+gpt_batch_loop() {
+    gpt_batch_t  batch;
+    gpt_limit_t  limit;
+    FILE        *in = stdin, *out = stdout;
+    int          rc = -1;
+
+    if (strcmp(opt.batch, "-") != 0 && (in = fopen(opt.batch, "r")) == NULL) {
+        fprintf(stderr, "(cgpt): %s: %s\n", opt.batch, strerror(errno));
+        return -1;
+    }
+    if (opt.out != NULL && (out = fopen(opt.out, "w")) == NULL) {
+        fprintf(stderr, "(cgpt): %s: %s\n", opt.out, strerror(errno));
+        goto out;
+    }
+    if (gpt_batch_init(&batch, opt.loop, in, out, opt.jobs) == -1)
+        goto out;
+    batch.system = opt.system;
+    batch.start = gpt_request_start;
+    batch.vocab = opt.vocab;
+    batch.flight = &opt.flight;
+    batch.cache = opt.cache;
+    /* requests wait on the loop instead of running into 429 */
+    if (opt.rpm > 0 || opt.tpm > 0) {
+        gpt_limit_init(&limit, opt.loop, opt.rpm, opt.tpm);
+        batch.limit = &limit;
+        opt.limit = &limit;
+    }
+
+    rc = gpt_batch_run(&batch);
+    fprintf(stderr, "(cgpt): batch: %ld completed, %ld failed\n", batch.ok, batch.failed);
+    if (batch.limit != NULL) {
+        if (limit.queued > 0)
+            fprintf(stderr, "(cgpt): rate limit: %ld requests queued %.1fs in total, %.1fs at most\n",
+                    limit.queued, limit.waited / 1000.0, limit.longest / 1000.0);
+        gpt_limit_free(&limit);
+        opt.limit = NULL;
+    }
+    if (opt.cache != NULL)
+        fprintf(stderr, "(cgpt): cache: %ld hits, %ld misses\n", opt.cache->hits, opt.cache->misses);
+    if (opt.flight.joined > 0)
+        fprintf(stderr, "(cgpt): %ld duplicate requests joined one in flight\n", opt.flight.joined);
+    gpt_batch_free(&batch);
+out:
+    if (in != stdin)
+        fclose(in);
+    if (out != NULL && out != stdout)
+        fclose(out);
+    return rc;
+}
+
+static void
+gpt_serve_signal(gpt_io_t *io, int events) {
+    struct signalfd_siginfo si;
+
+    while (read(io->fd, &si, sizeof(si)) == sizeof(si))
+        gpt_loop_stop(opt.loop);
+}
+
+/*
+ * Answer the requests of other programs on opt.serve instead
+ * of the console, until SIGINT or SIGTERM
+ */
+static int
+gpt_serve_loop() {
+    gpt_serve_t  serve;
+    gpt_limit_t  limit;
+    gpt_io_t     sig;
+    sigset_t     mask;
+    int          fd, rc;
+
+    if (gpt_serve_init(&serve, opt.loop, opt.serve, opt.serve_any) == -1) {
+        fprintf(stderr, "(cgpt): serve %s: %s\n", opt.serve, strerror(errno));
+        return -1;
+    }
+    serve.start = gpt_request_start;
+    serve.vocab = opt.vocab;
+    serve.flight = &opt.flight;
+    serve.cache = opt.cache;
+    serve.jobs = opt.jobs > 0 ? opt.jobs : GPT_BATCH_JOBS;
+    /* one rate limit for every client, they share the key */
+    if (opt.rpm > 0 || opt.tpm > 0) {
+        gpt_limit_init(&limit, opt.loop, opt.rpm, opt.tpm);
+        serve.limit = &limit;
+        opt.limit = &limit;
+    }
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    if ((fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) != -1
+        && gpt_loop_add(opt.loop, &sig, fd, GPT_EV_READ, gpt_serve_signal, NULL) == -1) {
+        close(fd);
+        fd = -1;
+    }
+
+    fprintf(stderr, "(cgpt): serving %s\n", opt.serve);
+    rc = gpt_loop_run(opt.loop);
+    fprintf(stderr, "(cgpt): served %ld requests, %ld failed\n", serve.served, serve.failed);
+    if (opt.cache != NULL)
+        fprintf(stderr, "(cgpt): cache: %ld hits, %ld misses\n", opt.cache->hits, opt.cache->misses);
+    if (opt.flight.joined > 0)
+        fprintf(stderr, "(cgpt): %ld duplicate requests joined one in flight\n", opt.flight.joined);
+
+    gpt_serve_free(&serve);
+    if (serve.limit != NULL) {
+        gpt_limit_free(&limit);
+        opt.limit = NULL;
+    }
+    if (fd != -1) {
+        gpt_loop_del(opt.loop, &sig);
+        close(fd);
+    }
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    return rc;
+}
+
 static void  
 gpt_do_completion(char const *prefix, linenoiseCompletions *lc) {
 
@@ -179,66 +684,113 @@ gpt_request_init(const gpt_jfile_t *jf) {
             opt.proxy = strdup(GPT_PROXY);
     }
 
+    if (jf && jf->stream)
+        opt.stream = 1;
+
+    if (jf && jf->system) {
+        free(opt.system);
+        opt.system = strdup(jf->system);
+    }
+
     if (jf && jf->timeout != 0) {
         opt.timeout = jf->timeout;
     } else {
         if (opt.timeout == 0)
             opt.timeout = 10;
     }
+
+    /*
+     * Requests go out over a native socket whenever url and proxy
+     * can be handled in process, otherwise fall back to curl.
+     */
+    if (opt.keepalive < 0)
+        opt.keepalive = GPT_POOL_IDLE;
+    /* every batch job may hold a connection */
+    if (opt.pool == NULL)
+        opt.pool = gpt_pool_create(opt.jobs > GPT_POOL_MAX ? opt.jobs : GPT_POOL_MAX,
+                                   opt.keepalive);
+
+    if (opt.cachedir != NULL && opt.cache == NULL) {
+        gpt_url_t   u;
+        char        target[1536];
+
+        /* replies are kept per endpoint, whichever proxy they come through */
+        if (gpt_http_url(&u, opt.url, 0) == 0)
+            snprintf(target, sizeof(target), "%s://%s:%s%s%s", u.tls ? "https" : "http",
+                     u.host, u.port, u.path, u.sock);
+        else
+            snprintf(target, sizeof(target), "%s", opt.url);
+        if ((opt.cache = gpt_cache_open(opt.cachedir, (size_t)opt.cachesize << 20, target)) == NULL)
+            printf("(cgpt): cache %s: %s\n", opt.cachedir, strerror(errno));
+    }
+
+    opt.http = gpt_http_create(opt.url, opt.proxy, opt.timeout);
+    if (opt.http != NULL) {
+        if (gpt_http_header(opt.http, opt.head) == -1
+            || gpt_http_header(opt.http, opt.auth) == -1
+            || (opt.pool && gpt_http_pool(opt.http, opt.pool) == -1)) {
+            gpt_http_destroy(opt.http);
+            opt.http = NULL;
+        }
+    }
 }
 
+/*
+ * Free the fixed parameters a json file (-f) replaces
+ */
 static void
 gpt_request_clear() {
     if (opt.head != NULL) free(opt.head);
     if (opt.auth != NULL) free(opt.auth);
     if (opt.url != NULL) free(opt.url);
     if (opt.proxy != NULL) free(opt.proxy);
+    opt.head = NULL;
+    opt.auth = NULL;
+    opt.url = NULL;
+    opt.proxy = NULL;
 }
 
-static char *
-gpt_request_data(char **request, int n) {
-    int             i;
-    char            *data;
-    gpt_message_t   *gmsg;
+/*
+ * Release every option at exit, the request fixed parameters
+ * included, and the client objects built from them
+ */
+static void
+gpt_option_free() {
+    gpt_http_destroy(opt.http);
+    opt.http = NULL;
+    gpt_pool_destroy(opt.pool);
+    opt.pool = NULL;
+    gpt_cache_close(opt.cache);
+    opt.cache = NULL;
+    gpt_request_clear();
+    if (opt.system != NULL) free(opt.system);
+    if (opt.batch != NULL) free(opt.batch);
+    if (opt.out != NULL) free(opt.out);
+    if (opt.cachedir != NULL) free(opt.cachedir);
+    if (opt.serve != NULL) free(opt.serve);
+    opt.serve = NULL;
+    opt.system = NULL;
+    opt.batch = NULL;
+    opt.out = NULL;
+    opt.cachedir = NULL;
+}
+
+/*
+ * Build the request body for the conversation into b,
+ * the earlier messages come serialized from its cache
+ */
+static int
+gpt_request_data(gpt_conv_t *conv, gpt_buf_t *b) {
     gpt_request_t   param;
 
     strncpy(param.model, GPT_MODEL, sizeof(param.model));
     param.temperature = 0.7;
-    /*
-     * Designing n+1 requests is to make the last one empty, 
-     * so that it is convenient to confirm the boundary when 
-     * traversing
-     */
-    param.msg = malloc(n * sizeof(*param.msg));
-    memset(param.msg, 0, n * sizeof(*param.msg));
-    gmsg = param.msg;
-    for (i = 0; i < n; i++) {
-        gmsg->content = strdup(*(request + i));
-        strncpy(gmsg->role, "user", sizeof(gmsg->role));
-        gmsg++;
-    }
+    param.stream = opt.stream;
+    param.msg = NULL;
     /*
      * Get request packet string
      */
-    data = gpt_json_data(&param, n);
-    /*
-     * The  strdup() function returns a pointer to a new string 
-     * which is a duplicate of the string s.  Memory for the
-     * new string is obtained with malloc(3), and can be freed with free(3).
-     */
-    gpt_request_free(&param, n);
-    return data;
-}
-
-static void
-gpt_request_free(gpt_request_t *rq, int n) {
-    gpt_message_t   *gmsg;
-
-    gmsg = rq->msg;
-    for (int i = 0; i < n; i++) {
-        free(gmsg->content);
-    }
-    free(gmsg);
+    return gpt_conv_data(conv, &param, b);
 }
 
 /*
@@ -263,6 +815,8 @@ gpt_request_cmd(const char *content) {
 
     strcat(cmdline, "curl");
     strcat(cmdline, " --insecure -s --show-error ");
+    if (opt.stream || opt.serve != NULL)
+        strcat(cmdline, " -N ");
     if (opt.proxy != NULL) {
         strcat(cmdline, " -x ");
         strcat(cmdline, opt.proxy);
@@ -292,161 +846,132 @@ gpt_request_cmd(const char *content) {
 }
 
 /*
- * Send request, parse data
+ * Body callback of streamed requests, the raw body
+ * is kept by the call (rsp.keep) for the cache
  */
-static FILE *
-gpt_request_send(const char *cmdline) {
-    FILE   *fp;
-
-    /*
-     * The  popen() function opens a process by creating a pipe, 
-     * forking, and invoking the shell.  Since a
-     * pipe is by definition unidirectional, the type argument may
-     * specify only reading  or  writing,  not
-     * both; the resulting stream is correspondingly read-only or write-only.
-     */
-    if ((fp = popen(cmdline, "r")) != NULL)
-        return fp;
-    return NULL;
+static void
+gpt_request_chunk(gpt_response_t *rsp, const char *data, size_t len) {
+    gpt_sse_feed((gpt_sse_t *)rsp->arg, data, len);
 }
 
 /*
- * Read data from the stream and save it in buf,
- * and call free to release it after use
- * return NULL after 3 consecutive timeouts without data returned
+ * Start the request on opt.loop, natively or through a curl child.
+ * done is called with the call once it is over, sse (if not NULL)
+ * gets the body while it arrives. Retries take tokens of opt.limit
+ * again. Return NULL if it did not start.
  */
-static int
-gpt_respond_buf(FILE *fp, char **buf) {
-    // Setup select() parameters
-    fd_set          rfds;
-    struct timeval  tv;
-    int             retval;
-    int             count = 0;
-
-    FILE           *fm;
-    char           *bf = NULL;
-    char           *line = NULL;
-    size_t          len;
-    size_t          size = 0;
-
-    /*
-     * The function ferror() tests the error indicator for the stream pointed to by stream,
-     * returning nonzero if it  is set.  The error indicator can be 
-     * reset only by the clearerr() function.
-     */
-    if (ferror(fp)) {
-        GCLOG_ERROR(opt.clog, "%d,%s", getpid(), "ferror true.");
-        goto err;
-    }
-
-    // Watch stdin (fd 0) to see when it has input.
-    FD_ZERO(&rfds);
-    FD_SET(fileno(fp), &rfds);
-
-    // Wait up to 5 seconds.
-    tv.tv_sec = 15;
-    tv.tv_usec = 0;
+static gpt_call_t *
+gpt_request_start(const gpt_buf_t *req, gpt_sse_t *sse, long tokens,
+                  void (*done)(gpt_call_t *call), void *arg) {
+    gpt_call_t *call;
+    char       *cmd;
+    int         rc;
 
-    // Wait until file is ready for reading
-    while (1) {
-        retval = select(fileno(fp) + 1, &rfds, NULL, NULL, &tv);
-        if (retval == -1) {
-            perror("select()");
-            exit(1);
-        } else if (retval == 0) {
-            GCLOG_INFO(opt.clog, "%d,%s %d", getpid(), "Timeout reached", count);
-            if (++count == 3)
-                return 0;
-            /*
-             * If the timeout count is less than 3, continue to extend the waiting time.
-             */
-            FD_ZERO(&rfds);
-            FD_SET(fileno(fp), &rfds);
-            tv.tv_sec = count * 25;
-            tv.tv_usec = 0;
-            continue;
-        } else {
-            if (FD_ISSET(fileno(fp), &rfds))
-                break;
-        }
+    if ((call = gpt_call_create(opt.loop, done, arg)) == NULL)
+        return NULL;
+    call->retries = opt.retries > 0 ? opt.retries : 0;
+    call->limit = opt.limit;
+    call->cost = tokens;
+    if (sse != NULL) {
+        call->rsp.on_body = gpt_request_chunk;
+        call->rsp.arg = sse;
+        call->rsp.keep = 1;
     }
+    /* a request seen before is answered from the cache */
+    if (opt.cache != NULL && gpt_call_cache(call, opt.cache, req->data, req->len) == 1)
+        return call;
+    /* an identical request already running answers this one as well */
+    if (gpt_call_join(call, &opt.flight, req->data, req->len) == 1)
+        return call;
 
-    /*
-     * The open_memstream function is a system call used in the C programming language
-     * to create a stream that can write data to a memory buffer. It takes two arguments:
-     * a pointer to a character array, which will be the buffer to write the data into,
-     * and a pointer to an integer, which will be used to store the size of the data
-     * written to the buffer.
-     */
-    fm = open_memstream(buf, &size);
-    while (getline(&line, &len, fp) != -1) {
-        fputs(line, fm);
+    if (opt.http != NULL) {
+        if (gpt_call_http(call, opt.http, req->data, req->len) == 0)
+            return call;
+    } else if ((cmd = gpt_request_cmd(req->data)) != NULL) {
+        /*
+         * curl runs in a child of its own, its output is read from
+         * a pipe by the loop as it arrives and a cancelled call
+         * kills it.
+         */
+        rc = gpt_call_exec(call, cmd);
+        free(cmd);
+        if (rc == 0)
+            return call;
     }
-    fflush(fm);
-    free(line);
-    fclose(fm);
-    
-    return 0;
-err:
-    return -1;
+    gpt_call_free(call);
+    return NULL;
 }
 
-static inline void
-__gpt_print_data(char *s) {
-    printf("\n");
-    while (*s != '\0') {
-        usleep(50000);
-        printf("%c", *s);
-        fflush(stdout);
-        s++;
-    }
-    printf("\n\n");
+static void
+gpt_render_ready(gpt_io_t *io, int events) {
+    gpt_render_tick((gpt_render_t *)io->arg);
 }
 
+/*
+ * One event of a streamed reply, print the new piece right away
+ */
 static void
-gpt_response_parser(FILE *fp) {
-    char           *buf = NULL, *s;
-    cJSON          *root;
-    int             status = 0;
+gpt_response_delta(void *arg, const char *data, size_t len) {
+    gpt_buf_t  *text = (gpt_buf_t *)arg;
+    char       *s;
+    size_t      n;
 
-    status = gpt_respond_buf(fp, &buf);
-    if (buf == NULL || status == -1)
+    if (strcmp(data, "[DONE]") == 0)
         return;
-    
-    status = gpt_json_root(buf, &root);
+    if ((s = gpt_json_delta(data)) == NULL)
+        return;
+    if ((n = strlen(s)) > 0) {
+        if (text->len == 0)
+            gpt_render_begin(&opt.render);
+        gpt_render_write(&opt.render, s, n);
+        /* the whole reply becomes the assistant turn */
+        gpt_buf_append(text, s, n);
+    }
+    cJSON_free(s);
+}
 
-    if (status == 0) {
-        gpt_object_t   *obj = NULL;
+static inline void
+__gpt_print_data(const char *s, size_t len) {
+    gpt_render_begin(&opt.render);
+    gpt_render_write(&opt.render, s, len);
+    gpt_render_end(&opt.render);
+}
 
-        obj = gpt_json_parse(buf);
-        for (int i = 0; i < obj->choices_num; i++) {
-            gpt_choice_t *t = obj->choices + i;
-            s = t->msg.content;
-            __gpt_print_data(s);
-        }
-        gpt_json_free(obj);
-    } else {
-        gpt_error_t    *err;
+/*
+ * Parse the reply and print it, buf is decoded in place and
+ * released here, the text is written straight out of it.
+ * Return 0 if it was a completion (now part of the conversation)
+ */
+static int
+gpt_response_parser(char *buf, size_t len) {
+    gpt_view_t      v;
+    int             rc = -1;
 
-        err = gpt_json_error(buf);
-        s = err->message;
-        __gpt_print_data(s);
-        gpt_json_error_free(err);
+    switch (gpt_json_view(buf, len, &v)) {
+    case 0:
+        for (int i = 0; i < v.choices_num; i++)
+            __gpt_print_data(v.choices[i].content.s, v.choices[i].content.len);
+        if (v.choices_num > 0)
+            rc = gpt_conv_append(opt.conv, "assistant",
+                                 v.choices[0].content.s, v.choices[0].content.len);
+        break;
+    case 1:
+        __gpt_print_data(v.message.s, v.message.len);
+        break;
+    default:
+        printf("(cgpt): unexpected response\n");
+        break;
     }
-    cJSON_Delete(root);
-    /*
-     * Read data from the stream and save it in buf,
-     * and call free to release it after use
-     */
-    free(buf);
-    return;
+    gpt_json_view_free(&v);
+    return rc;
 }
 
 static gpt_jfile_t *
 gpt_file_option() {
     char *jf = NULL;
     gpt_jfile_t *gjf = NULL;
-    // first free option's old value
+    // first free the old values of what the file may set,
+    // the other command line options stay as they are
     gpt_request_clear();
     jf = readfile(opt.jfile);
 
@@ -472,11 +997,27 @@ int main(int argc, char *argv[]) {
             {"file",    required_argument, 0,  'f' },
             {"url",     required_argument, 0,   0  },
             {"timeout", required_argument, 0,   0  },
+            {"keepalive", required_argument, 0, 0  },
+            {"cps",     required_argument, 0,   0  },
+            {"system",  required_argument, 0,   0  },
+            {"context", required_argument, 0,   0  },
+            {"vocab",   required_argument, 0,   0  },
+            {"batch",   required_argument, 0,   0  },
+            {"out",     required_argument, 0,   0  },
+            {"jobs",    required_argument, 0,   0  },
+            {"retries", required_argument, 0,   0  },
+            {"rpm",     required_argument, 0,   0  },
+            {"tpm",     required_argument, 0,   0  },
+            {"cache",   required_argument, 0,   0  },
+            {"cache-size", required_argument, 0, 0 },
+            {"serve",   required_argument, 0,   0  },
+            {"serve-any", no_argument,     0,   0  },
+            {"stream",  no_argument,       0,  's' },
             {"help",    no_argument,       0,  'h' },
             {0,         0,                 0,   0  }
         };
 
-        c = getopt_long(argc, argv, "x:k:f:hv", long_options, &option_index);
+        c = getopt_long(argc, argv, "x:k:f:shv", long_options, &option_index);
         if (c == -1)
             break;
         
@@ -488,6 +1029,74 @@ int main(int argc, char *argv[]) {
                 if (optarg)
                     opt.timeout = strtol(optarg, NULL, 10); 
             }
+            // set system message
+            if (option_index == 7) {
+                if (optarg)
+                    opt.system = strdup(optarg);
+            }
+            // set context window
+            if (option_index == 8) {
+                if (optarg)
+                    opt.context = strtol(optarg, NULL, 10);
+            }
+            // load token ranks
+            if (option_index == 9) {
+                if (optarg && (opt.vocab = gpt_vocab_load(optarg)) == NULL)
+                    printf("(cgpt): cannot load %s, token counts are estimated\n", optarg);
+            }
+            // set batch input, output and concurrency
+            if (option_index == 10) {
+                if (optarg)
+                    opt.batch = strdup(optarg);
+            }
+            if (option_index == 11) {
+                if (optarg)
+                    opt.out = strdup(optarg);
+            }
+            if (option_index == 12) {
+                if (optarg)
+                    opt.jobs = strtol(optarg, NULL, 10);
+            }
+            // set retries of transient failures
+            if (option_index == 13) {
+                if (optarg)
+                    opt.retries = strtol(optarg, NULL, 10);
+            }
+            // set the rate limit of batch requests
+            if (option_index == 14) {
+                if (optarg)
+                    opt.rpm = strtol(optarg, NULL, 10);
+            }
+            if (option_index == 15) {
+                if (optarg)
+                    opt.tpm = strtol(optarg, NULL, 10);
+            }
+            // set the response cache
+            if (option_index == 16) {
+                if (optarg)
+                    opt.cachedir = strdup(optarg);
+            }
+            if (option_index == 17) {
+                if (optarg)
+                    opt.cachesize = strtol(optarg, NULL, 10);
+            }
+            // serve other programs instead of the console
+            if (option_index == 18) {
+                if (optarg)
+                    opt.serve = strdup(optarg);
+            }
+            if (option_index == 19)
+                opt.serve_any = 1;
+            // set typewriter speed
+            if (option_index == 6) {
+                if (optarg)
+                    opt.cps = strtol(optarg, NULL, 10);
+            }
+            // set idle time of kept connections
+            if (option_index == 5) {
+                if (optarg)
+                    opt.keepalive = strtol(optarg, NULL, 10);
+            }
             // set url
             if (option_index == 3) {
                 if (optarg) {
@@ -512,6 +1121,9 @@ int main(int argc, char *argv[]) {
                 jf = gpt_file_option();
             }
             break;
+        case 's':
+            opt.stream = 1;
+            break;
         case 'v':
             printf("%s %s\n", argv[0]+2, GPT_VERSION);
             exit(EXIT_SUCCESS);
@@ -534,18 +1146,58 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
     
+    if ((opt.loop = gpt_loop_create()) == NULL) {
+        printf("(cgpt): event loop: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
     gpt_request_init(jf);
     gpt_json_file_free(jf);
 
+    if (opt.serve != NULL) {
+        c = gpt_serve_loop();
+        gpt_vocab_free(opt.vocab);
+        gpt_option_free();
+        gpt_loop_destroy(opt.loop);
+        return c == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (opt.batch != NULL) {
+        c = gpt_batch_loop();
+        gpt_vocab_free(opt.vocab);
+        gpt_option_free();
+        gpt_loop_destroy(opt.loop);
+        return c == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     printf("%s", usage);
     opt.clog = gpt_clog_creat("./logcgpt/", 1024);
     if (opt.clog == NULL) {
         return -1;
     }
+    /* logging stays off the console thread */
+    if (gpt_clog_async(opt.clog, GPT_CLOG_SLOTS) == -1)
+        printf("(cgpt): log writer: %s\n", strerror(errno));
     //GCLOG_INFO(opt.clog, "%d,%s", getpid(), "clog Initialization.");
 
+    if ((opt.arena = gpt_arena_create(GPT_ARENA_CHUNK)) == NULL)
+        return -1;
+    if (opt.context <= GPT_CONTEXT_REPLY)
+        opt.context = GPT_CONTEXT;
+    if ((opt.conv = gpt_conv_create(opt.system, opt.vocab)) == NULL)
+        return -1;
+    if (gpt_render_init(&opt.render, STDOUT_FILENO, opt.cps) == -1)
+        printf("(cgpt): typewriter timer: %s\n", strerror(errno));
+    /* the typewriter runs while the rest of the reply is arriving */
+    if (opt.render.tfd != -1)
+        gpt_loop_add(opt.loop, &opt.tick, opt.render.tfd, GPT_EV_READ, gpt_render_ready, &opt.render);
+
     gpt_console_loop();
-    gpt_request_clear();
+    gpt_render_close(&opt.render);
+    gpt_arena_destroy(opt.arena);
+    gpt_conv_destroy(opt.conv);
+    gpt_vocab_free(opt.vocab);
+    gpt_option_free();
+    gpt_loop_destroy(opt.loop);
     gpt_clog_close(opt.clog);
 
     return 0;
@@ -6,13 +6,74 @@
 
 #include <gpt_config.h>
 
+#define GPT_CONSOLE_LINE    4096    /* longest prompt typed at the console */
+
+/*
+ * A line typed while a reply was arriving, it runs after it
+ */
+struct console_line {
+    struct console_line *next;
+    char                 line[];
+};
+
+/*
+ * The interactive session. On a terminal the prompt is edited on the
+ * loop and stays below the reply being printed. Ctrl-C (the key or
+ * SIGINT) cancels the request of a busy prompt and nothing else.
+ */
+struct console {
+    struct linenoiseState ls;
+    char            buf[GPT_CONSOLE_LINE];
+    int             editing;    /* ls is on the screen */
+    int             col;        /* column the last line of the reply ends at */
+    int             quit;
+    int             busy;       /* a prompt is waiting for its reply */
+    int             running;    /* queued lines are being started */
+    gpt_io_t        in;         /* stdin on the loop */
+    int             sigfd;      /* SIGINT while busy, -1 if not available */
+    gpt_io_t        sig;
+    gpt_call_t     *call;       /* request of the busy prompt */
+    gpt_buf_t       req;
+    gpt_buf_t       text;       /* streamed reply so far */
+    gpt_sse_t       sse;
+    struct console_line *head;  /* typed while busy, run in order */
+    struct console_line *tail;
+};
+
 struct gptoption {
     char *url;
     char *proxy;
     char *auth;
     char *head;
+    char *system;     /* System message of the conversation, may be NULL */
     char  jfile[PATH_MAX];
     long  timeout;
+    int   stream;     /* Ask for server-sent events and print them as they arrive */
+    long  cps;        /* Typewriter speed in characters per second, 0 is off */
+    long  keepalive;  /* Seconds idle connections are kept, 0 disables reuse */
+    gpt_http_t *http; /* Native transport, NULL when requests go through curl */
+    gpt_pool_t *pool; /* Keep-alive connections shared by all requests */
+    gpt_render_t render; /* Writes replies to stdout */
+    gpt_loop_t  *loop;   /* Drives requests, timers and the terminal */
+    gpt_io_t     tick;   /* Typewriter timer of render on loop */
+    gpt_console_t console; /* Prompt and reply of the interactive session */
+    gpt_arena_t *arena;  /* Per-request allocations, reset after each reply */
+    gpt_conv_t  *conv;   /* Messages of this session, sent with every prompt */
+    long         context; /* Tokens a request may take, reply included */
+    gpt_vocab_t *vocab;  /* Token ranks, NULL estimates token counts */
+    char        *batch;  /* Prompts file of batch mode, NULL runs the console */
+    char        *out;    /* Batch results file, NULL writes to stdout */
+    long         jobs;   /* Batch requests in flight */
+    long         retries; /* Retries of rate limits, server errors and lost requests */
+    long         rpm;    /* Batch requests per minute, 0 is no limit */
+    long         tpm;    /* Batch tokens per minute, 0 is no limit */
+    gpt_limit_t *limit;  /* Rate limit of batch or server mode, NULL for none */
+    char        *cachedir; /* Response cache directory, NULL disables it */
+    long         cachesize; /* Megabytes the cache may take */
+    gpt_cache_t *cache;
+    gpt_flight_t flight; /* Requests in flight, identical ones are sent once */
+    char        *serve;  /* Address served instead of the console, NULL for none */
+    int          serve_any; /* It may be other than the loopback interface */
     gpt_clog_t *clog; /* If you want to log to a file in the logging module 
                        * and use the compilation option -DCLOG_OPTION at compile time.*/
 };
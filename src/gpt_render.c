@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ */
+#include <gpt_config.h>
+#include <sys/timerfd.h>
+
+static void
+_gpt_render_out(gpt_render_t *r, const char *s, size_t len) {
+    ssize_t n;
+
+    if (len == 0)
+        return;
+    if (r->out != NULL) {
+        r->out(r->arg, s, len);
+        return;
+    }
+    while (len > 0) {
+        if ((n = write(r->fd, s, len)) == -1) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        s += n;
+        len -= n;
+    }
+}
+
+/*
+ * Arm or stop the typewriter timer, return -1 if it could not be armed
+ */
+static int
+_gpt_render_timer(gpt_render_t *r, int on) {
+    struct itimerspec its;
+
+    if (r->tfd == -1 || r->armed == on)
+        return 0;
+    memset(&its, 0, sizeof(its));
+    if (on) {
+        its.it_interval.tv_nsec = 1000000000L / GPT_RENDER_HZ;
+        its.it_value = its.it_interval;
+        clock_gettime(CLOCK_MONOTONIC, &r->last);
+    }
+    if (timerfd_settime(r->tfd, 0, &its, NULL) == -1)
+        return -1;
+    r->armed = on;
+    return 0;
+}
+
+int
+gpt_render_init(gpt_render_t *r, int fd, long cps) {
+    memset(r, 0, sizeof(*r));
+    r->fd = fd;
+    r->tty = isatty(fd);
+    r->tfd = -1;
+
+    if (cps > 0 && r->tty) {
+        r->cps = cps;
+        r->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        if (r->tfd == -1)
+            return -1;
+    }
+    return 0;
+}
+
+void
+gpt_render_begin(gpt_render_t *r) {
+    /* whatever printf() left in stdio must come first */
+    if (r->out == NULL)
+        fflush(stdout);
+    /* the typewriter may still be busy with the previous reply */
+    if (!r->armed) {
+        gpt_buf_reset(&r->pending);
+        r->done = 0;
+        r->credit = 0;
+    }
+    if (r->tty)
+        gpt_render_write(r, "\n", 1);
+}
+
+/*
+ * Write up to the typewriter credit, counted in UTF-8
+ * characters so a multibyte character is never split
+ */
+static void
+_gpt_render_drain(gpt_render_t *r) {
+    struct timespec now;
+    const char     *s = r->pending.data + r->done;
+    size_t          i = 0, left = r->pending.len - r->done;
+    long            chars;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    r->credit += r->cps * ((now.tv_sec - r->last.tv_sec)
+                            + (now.tv_nsec - r->last.tv_nsec) / 1e9);
+    r->last = now;
+
+    for (chars = (long)r->credit; chars > 0 && i < left; chars--) {
+        i++;
+        while (i < left && (s[i] & 0xC0) == 0x80)
+            i++;
+    }
+    r->credit -= (long)r->credit - chars;
+    _gpt_render_out(r, s, i);
+    r->done += i;
+
+    /* credit does not pile up while waiting for text */
+    if (r->done == r->pending.len) {
+        gpt_buf_reset(&r->pending);
+        r->done = 0;
+        r->credit = 0;
+        _gpt_render_timer(r, 0);
+    }
+}
+
+void
+gpt_render_write(gpt_render_t *r, const char *s, size_t len) {
+    if (!r->tty) {
+        /* not a terminal, everything leaves in gpt_render_end */
+        gpt_buf_append(&r->pending, s, len);
+        return;
+    }
+    if (r->tfd == -1) {
+        _gpt_render_out(r, s, len);
+        return;
+    }
+    gpt_buf_append(&r->pending, s, len);
+    if (!r->armed && _gpt_render_timer(r, 1) == -1) {
+        /* nothing would ever write it, the reply goes out at once */
+        _gpt_render_out(r, r->pending.data + r->done, r->pending.len - r->done);
+        gpt_buf_reset(&r->pending);
+        r->done = 0;
+    }
+}
+
+void
+gpt_render_tick(gpt_render_t *r) {
+    uint64_t    expired;
+
+    if (read(r->tfd, &expired, sizeof(expired)) == -1 && errno != EAGAIN)
+        return;
+    _gpt_render_drain(r);
+}
+
+void
+gpt_render_end(gpt_render_t *r) {
+    if (!r->tty) {
+        gpt_buf_append(&r->pending, "\n", 1);
+        _gpt_render_out(r, r->pending.data, r->pending.len);
+        gpt_buf_reset(&r->pending);
+        return;
+    }
+
+    gpt_render_write(r, "\n\n", 2);
+}
+
+void
+gpt_render_abort(gpt_render_t *r) {
+    gpt_buf_reset(&r->pending);
+    r->done = 0;
+    r->credit = 0;
+    _gpt_render_timer(r, 0);
+}
+
+void
+gpt_render_close(gpt_render_t *r) {
+    if (r->tfd != -1)
+        close(r->tfd);
+    r->tfd = -1;
+    gpt_buf_free(&r->pending);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ * Output of replies: plain buffered writes on a terminal, an optional
+ * typewriter effect paced by a timer, and a single write() when the
+ * output is not a terminal (pipes, files).
+ */
+#ifndef __GPT_RENDER__
+#define __GPT_RENDER__
+
+#include <gpt_config.h>
+
+#define GPT_RENDER_HZ   60      /* typewriter ticks per second */
+
+struct render {
+    int         fd;         /* output, normally STDOUT_FILENO */
+    int         tty;
+    long        cps;        /* typewriter speed in characters per second, 0 = off */
+    int         tfd;        /* timerfd driving the typewriter, -1 if off */
+    int         armed;
+    double      credit;     /* characters that may be written now */
+    struct timespec last;   /* when credit was last topped up */
+    gpt_buf_t   pending;    /* text of the reply not written yet */
+    size_t      done;       /* bytes of pending already written */
+    /* takes the place of write(fd) when set, e.g. to keep a prompt below the reply */
+    void      (*out)(void *arg, const char *s, size_t len);
+    void       *arg;
+};
+
+/*
+ * Set up rendering to fd, cps > 0 turns the typewriter effect on
+ * (terminals only). Return 0 if successful, otherwise return -1
+ */
+int gpt_render_init(gpt_render_t *r, int fd, long cps);
+/*
+ * A reply starts / continues / is complete, the typewriter
+ * keeps writing what is left on its timer after gpt_render_end
+ */
+void gpt_render_begin(gpt_render_t *r);
+void gpt_render_write(gpt_render_t *r, const char *s, size_t len);
+void gpt_render_end(gpt_render_t *r);
+/*
+ * The reply was cancelled, text not written yet is dropped
+ */
+void gpt_render_abort(gpt_render_t *r);
+/*
+ * Typewriter timer fired, write the characters that are due
+ */
+void gpt_render_tick(gpt_render_t *r);
+void gpt_render_close(gpt_render_t *r);
+
+#endif
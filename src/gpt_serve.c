@@ -0,0 +1,680 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ */
+#include <gpt_config.h>
+#include <sys/un.h>
+
+/*
+ * One connected client, requests on it are answered one at a time
+ */
+struct serve_client {
+    gpt_serve_t         *serve;
+    gpt_io_t             io;
+    gpt_buf_t            in;
+    size_t               head;      /* bytes of the request head, 0 until it is whole */
+    size_t               length;    /* Content-Length of its body */
+    int                  close;     /* Connection: close, after the reply */
+    int                  eof;       /* the client sends nothing more */
+    int                  dead;      /* writing failed, closed from its own event */
+    int                  busy;      /* a request is being answered */
+    int                  stream;    /* events are asked for */
+    int                  chunked;   /* events are being relayed */
+    int                  waiting;   /* for the rate limit */
+    int                  starting;  /* inside start, done may run before it returns */
+    int                  queued;    /* for a request slot */
+    long                 tokens;    /* estimate the rate limit admitted */
+    gpt_wait_t           wait;
+    gpt_buf_t            req;
+    gpt_call_t          *call;
+    gpt_sse_t            sse;
+    gpt_buf_t            out;
+    size_t               sent;
+    struct serve_client *next;
+    struct serve_client *qnext;
+};
+
+static void _gpt_serve_parse(struct serve_client *cl);
+static int _gpt_serve_next(struct serve_client *cl);
+static void _gpt_serve_dequeue(gpt_serve_t *s);
+
+static const char *
+_gpt_serve_reason(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 411: return "Length Required";
+    case 413: return "Payload Too Large";
+    case 429: return "Too Many Requests";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    default:  return "Unknown";
+    }
+}
+
+static void
+_gpt_serve_close(struct serve_client *cl) {
+    gpt_serve_t          *s = cl->serve;
+    struct serve_client **pp;
+    gpt_call_t           *call;
+    int                   fd;
+
+    for (pp = &s->clients; *pp != NULL; pp = &(*pp)->next) {
+        if (*pp == cl) {
+            *pp = cl->next;
+            break;
+        }
+    }
+    if (cl->queued) {
+        for (pp = &s->queue; *pp != NULL; pp = &(*pp)->qnext) {
+            if (*pp == cl) {
+                *pp = cl->qnext;
+                break;
+            }
+        }
+    }
+    if (cl->waiting)
+        gpt_limit_cancel(s->limit, &cl->wait);
+    /* a request joined by others runs on for them */
+    if ((call = cl->call) != NULL) {
+        gpt_call_free(call);
+        s->running--;
+    }
+    if ((fd = cl->io.fd) != -1) {
+        gpt_loop_del(s->loop, &cl->io);
+        close(fd);
+    }
+    gpt_sse_free(&cl->sse);
+    gpt_buf_free(&cl->in);
+    gpt_buf_free(&cl->req);
+    gpt_buf_free(&cl->out);
+    free(cl);
+    /* its slot goes to the next request */
+    if (call != NULL)
+        _gpt_serve_dequeue(s);
+}
+
+/*
+ * Write out what is queued, the rest waits for the socket to
+ * drain. Return -1 once the client can not be written to.
+ */
+static int
+_gpt_serve_flush(struct serve_client *cl) {
+    gpt_serve_t *s = cl->serve;
+    ssize_t      n;
+
+    while (cl->sent < cl->out.len) {
+        n = send(cl->io.fd, cl->out.data + cl->sent, cl->out.len - cl->sent, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return gpt_loop_mod(s->loop, &cl->io, (cl->eof ? 0 : GPT_EV_READ) | GPT_EV_WRITE);
+            cl->dead = 1;
+            return -1;
+        }
+        cl->sent += n;
+    }
+    gpt_buf_reset(&cl->out);
+    cl->sent = 0;
+    return gpt_loop_mod(s->loop, &cl->io, cl->eof ? 0 : GPT_EV_READ);
+}
+
+static void
+_gpt_serve_reply(struct serve_client *cl, int status, const char *type,
+                 const char *body, size_t len) {
+    char    head[256];
+
+    snprintf(head, sizeof(head),
+            "HTTP/1.1 %d %s\r\n"
+            "Content-Type: %s\r\n"
+            "Content-Length: %zu\r\n"
+            "%s\r\n", status, _gpt_serve_reason(status), type, len,
+            cl->close ? "Connection: close\r\n" : "");
+    gpt_buf_puts(&cl->out, head);
+    gpt_buf_append(&cl->out, body, len);
+}
+
+/*
+ * An error object the way the upstream server would send it
+ */
+static void
+_gpt_serve_error(struct serve_client *cl, int status, const char *message) {
+    gpt_buf_t   b = {0};
+
+    gpt_buf_puts(&b, "{\"error\":{\"message\":");
+    gpt_json_escape(&b, message, strlen(message));
+    gpt_buf_puts(&b, status >= 500 ? ",\"type\":\"server_error\"" : ",\"type\":\"invalid_request_error\"");
+    gpt_buf_puts(&b, ",\"param\":null,\"code\":null}}\n");
+    _gpt_serve_reply(cl, status, "application/json", b.data, b.len);
+    gpt_buf_free(&b);
+}
+
+/*
+ * One event of a streamed reply goes to the client as it came,
+ * the response head goes out with the first one
+ */
+static void
+_gpt_serve_event(void *arg, const char *data, size_t len) {
+    struct serve_client    *cl = (struct serve_client *)arg;
+    const char             *p, *nl;
+    size_t                  lines;
+    char                    line[32];
+
+    if (!cl->chunked) {
+        gpt_buf_puts(&cl->out,
+                "HTTP/1.1 200 OK\r\n"
+                "Content-Type: text/event-stream\r\n"
+                "Cache-Control: no-cache\r\n"
+                "Transfer-Encoding: chunked\r\n");
+        if (cl->close)
+            gpt_buf_puts(&cl->out, "Connection: close\r\n");
+        gpt_buf_puts(&cl->out, "\r\n");
+        cl->chunked = 1;
+    }
+    /* every line of the data gets its own field, the parser joined them */
+    for (p = data, lines = 1; (p = memchr(p, '\n', data + len - p)) != NULL; p++)
+        lines++;
+    snprintf(line, sizeof(line), "%zx\r\n", len + lines * 6 + 2);
+    gpt_buf_puts(&cl->out, line);
+    for (p = data; ; p = nl + 1) {
+        if ((nl = memchr(p, '\n', data + len - p)) == NULL)
+            nl = data + len;
+        gpt_buf_puts(&cl->out, "data: ");
+        gpt_buf_append(&cl->out, p, nl - p);
+        gpt_buf_puts(&cl->out, "\n");
+        if (nl == data + len)
+            break;
+    }
+    gpt_buf_puts(&cl->out, "\n\r\n");
+    if (!cl->dead)
+        _gpt_serve_flush(cl);
+}
+
+/*
+ * Tokens the server counted for a completion, 0 if it does not say
+ */
+static void
+_gpt_serve_settle(struct serve_client *cl, gpt_call_t *call) {
+    gpt_serve_t *s = cl->serve;
+    cJSON       *root, *usage;
+    long         prompt = 0, completion = 0;
+
+    if (s->limit == NULL)
+        return;
+    if (call->replayed || call->rc == -1) {
+        gpt_limit_settle(s->limit, cl->tokens, 0, 0);
+        return;
+    }
+    if (cl->chunked)
+        return;
+    root = cJSON_ParseWithLength(call->rsp.body.data, call->rsp.body.len);
+    usage = cJSON_GetObjectItem(root, "usage");
+    if (cJSON_IsNumber(cJSON_GetObjectItem(usage, "prompt_tokens")))
+        prompt = cJSON_GetObjectItem(usage, "prompt_tokens")->valueint;
+    if (cJSON_IsNumber(cJSON_GetObjectItem(usage, "completion_tokens")))
+        completion = cJSON_GetObjectItem(usage, "completion_tokens")->valueint;
+    cJSON_Delete(root);
+    if (prompt + completion > 0)
+        gpt_limit_settle(s->limit, cl->tokens, prompt, completion);
+}
+
+/*
+ * The upstream request is over, answer the client and go on
+ * with the next request it sent
+ */
+static void
+_gpt_serve_done(gpt_call_t *call) {
+    struct serve_client    *cl = (struct serve_client *)call->arg;
+    gpt_serve_t            *s = cl->serve;
+    gpt_response_t         *rsp = &call->rsp;
+    int                     status;
+
+    _gpt_serve_settle(cl, call);
+    s->running--;
+    s->served++;
+    if (cl->chunked) {
+        /* a stream cut short must not look complete */
+        if (call->rc == 0)
+            gpt_buf_puts(&cl->out, "0\r\n\r\n");
+        else
+            cl->close = 1;
+    } else if (call->rc == -1 || rsp->body.len == 0) {
+        s->failed++;
+        _gpt_serve_error(cl, 502, "upstream request failed");
+    } else {
+        /* curl does not tell the status, an error object is enough */
+        status = rsp->status != 0 ? rsp->status : rsp->held ? 502 : 200;
+        _gpt_serve_reply(cl, status, "application/json", rsp->body.data, rsp->body.len);
+    }
+    gpt_call_free(call);
+    cl->call = NULL;
+    cl->busy = 0;
+    cl->chunked = 0;
+    gpt_sse_free(&cl->sse);
+    gpt_buf_reset(&cl->req);
+    /* whoever started the request goes on with the client */
+    if (!cl->starting) {
+        _gpt_serve_next(cl);
+        _gpt_serve_dequeue(s);
+    }
+}
+
+static void
+_gpt_serve_send(struct serve_client *cl) {
+    gpt_serve_t *s = cl->serve;
+    gpt_call_t  *call;
+
+    if (cl->stream) {
+        memset(&cl->sse, 0, sizeof(cl->sse));
+        cl->sse.on_event = _gpt_serve_event;
+        cl->sse.arg = cl;
+    }
+    s->running++;
+    cl->starting = 1;
+    call = s->start(&cl->req, cl->stream ? &cl->sse : NULL, cl->tokens,
+                    _gpt_serve_done, cl);
+    cl->starting = 0;
+    /* unless it failed at once and is already answered */
+    if (call != NULL && cl->busy)
+        cl->call = call;
+    if (call == NULL) {
+        s->running--;
+        s->served++;
+        s->failed++;
+        if (s->limit != NULL)
+            gpt_limit_settle(s->limit, cl->tokens, 0, 0);
+        cl->busy = 0;
+        _gpt_serve_error(cl, 502, "upstream request could not be started");
+    }
+}
+
+/*
+ * Start the next requests waiting for a slot
+ */
+static void
+_gpt_serve_dequeue(gpt_serve_t *s) {
+    struct serve_client *cl;
+
+    while (s->running < s->jobs && (cl = s->queue) != NULL) {
+        s->queue = cl->qnext;
+        cl->qnext = NULL;
+        cl->queued = 0;
+        _gpt_serve_send(cl);
+        if (!cl->busy)
+            _gpt_serve_next(cl);
+    }
+}
+
+/*
+ * Send the request once one of the jobs slots is free,
+ * the connection pool has no more connections than that
+ */
+static void
+_gpt_serve_forward(struct serve_client *cl) {
+    gpt_serve_t          *s = cl->serve;
+    struct serve_client **pp;
+
+    if (s->running < s->jobs) {
+        _gpt_serve_send(cl);
+        return;
+    }
+    for (pp = &s->queue; *pp != NULL; pp = &(*pp)->qnext)
+        ;
+    *pp = cl;
+    cl->queued = 1;
+}
+
+static void
+_gpt_serve_admit(gpt_wait_t *w) {
+    struct serve_client *cl = (struct serve_client *)w->arg;
+
+    cl->waiting = 0;
+    _gpt_serve_forward(cl);
+    if (!cl->busy)
+        _gpt_serve_next(cl);
+}
+
+/*
+ * A whole request is in, check it and send it on
+ */
+static void
+_gpt_serve_request(struct serve_client *cl, const char *method, const char *target,
+                   const char *body, size_t len) {
+    gpt_serve_t *s = cl->serve;
+    gpt_buf_t    text = {0};
+    size_t       n = strcspn(target, "?");
+    int          messages;
+
+    if (n != strlen(GPT_SERVE_PATH) || strncmp(target, GPT_SERVE_PATH, n) != 0) {
+        _gpt_serve_error(cl, 404, "unknown url, only " GPT_SERVE_PATH " is served");
+        return;
+    }
+    if (strcmp(method, "POST") != 0) {
+        _gpt_serve_error(cl, 405, "use POST");
+        return;
+    }
+    if (gpt_json_request(body, len, &cl->stream, &messages, s->limit ? &text : NULL) == -1) {
+        _gpt_serve_error(cl, 400, "the body is not a chat completion request");
+        return;
+    }
+
+    cl->busy = 1;
+    gpt_buf_reset(&cl->req);
+    gpt_buf_append(&cl->req, body, len);
+    cl->tokens = 0;
+    /* cached replies and duplicates in flight are not rate limited */
+    if (s->limit != NULL
+        && (s->cache == NULL || !gpt_cache_has(s->cache, body, len))
+        && (s->flight == NULL || !gpt_flight_has(s->flight, body, len))) {
+        cl->tokens = gpt_limit_estimate(s->limit, GPT_TOKEN_PRIMING
+                        + (long)messages * GPT_TOKEN_MESSAGE
+                        + gpt_token_count(s->vocab, text.data ? text.data : "", text.len));
+        gpt_buf_free(&text);
+        if (gpt_limit_acquire(s->limit, &cl->wait, cl->tokens, _gpt_serve_admit, cl) == 1) {
+            cl->waiting = 1;
+            return;
+        }
+    }
+    gpt_buf_free(&text);
+    _gpt_serve_forward(cl);
+}
+
+/*
+ * The value of header name in the head, NULL if it is not there
+ */
+static const char *
+_gpt_serve_header(const char *head, const char *name, size_t *len) {
+    const char *p = head, *v;
+    size_t      n = strlen(name);
+
+    while ((p = strstr(p, "\r\n")) != NULL) {
+        p += 2;
+        if (strncasecmp(p, name, n) == 0 && p[n] == ':') {
+            for (v = p + n + 1; *v == ' ' || *v == '\t'; v++)
+                ;
+            *len = strcspn(v, "\r\n");
+            return v;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Take the next whole request out of the input, a reply
+ * that does not need the upstream server is queued at once
+ */
+static void
+_gpt_serve_parse(struct serve_client *cl) {
+    char        method[16], target[1024], *end;
+    const char *v;
+    size_t      len;
+    int         minor;
+
+    while (!cl->busy && !cl->close && cl->in.len > 0) {
+        if (cl->head == 0) {
+            gpt_buf_append(&cl->in, "", 1);
+            cl->in.len--;
+            if ((end = strstr(cl->in.data, "\r\n\r\n")) == NULL) {
+                if (cl->in.len > GPT_SERVE_HEAD) {
+                    cl->close = 1;
+                    _gpt_serve_error(cl, 431, "request head too large");
+                }
+                break;
+            }
+            cl->head = end + 4 - cl->in.data;
+            *end = '\0';
+            if (sscanf(cl->in.data, "%15s %1023s HTTP/1.%d", method, target, &minor) != 3) {
+                cl->close = 1;
+                _gpt_serve_error(cl, 400, "malformed request line");
+                break;
+            }
+            cl->close = minor == 0;
+            if ((v = _gpt_serve_header(cl->in.data, "Connection", &len)) != NULL)
+                cl->close = strncasecmp(v, "close", len) == 0 ? 1
+                          : strncasecmp(v, "keep-alive", len) == 0 ? 0 : cl->close;
+            if (_gpt_serve_header(cl->in.data, "Transfer-Encoding", &len) != NULL) {
+                cl->close = 1;
+                _gpt_serve_error(cl, 411, "a Content-Length is required");
+                break;
+            }
+            cl->length = (v = _gpt_serve_header(cl->in.data, "Content-Length", &len)) != NULL
+                       ? strtoul(v, NULL, 10) : 0;
+            if (cl->length > GPT_SERVE_BODY) {
+                cl->close = 1;
+                _gpt_serve_error(cl, 413, "request body too large");
+                break;
+            }
+            if ((v = _gpt_serve_header(cl->in.data, "Expect", &len)) != NULL
+                && strncasecmp(v, "100-continue", len) == 0)
+                gpt_buf_puts(&cl->out, "HTTP/1.1 100 Continue\r\n\r\n");
+            /* the request line is looked at again once the body is in */
+            cl->in.data[strcspn(cl->in.data, "\r\n")] = '\0';
+        }
+        if (cl->in.len < cl->head + cl->length)
+            break;
+
+        sscanf(cl->in.data, "%15s %1023s", method, target);
+        _gpt_serve_request(cl, method, target, cl->in.data + cl->head, cl->length);
+        len = cl->head + cl->length;
+        memmove(cl->in.data, cl->in.data + len, cl->in.len - len);
+        cl->in.len -= len;
+        cl->head = 0;
+        cl->length = 0;
+    }
+    if (!cl->dead && cl->out.len > 0)
+        _gpt_serve_flush(cl);
+}
+
+/*
+ * Go on with the client once its reply is queued,
+ * return -1 if it has been closed
+ */
+static int
+_gpt_serve_next(struct serve_client *cl) {
+    if (!cl->dead)
+        _gpt_serve_parse(cl);
+    if (cl->dead || (!cl->busy && cl->out.len == 0 && (cl->close || cl->eof))) {
+        _gpt_serve_close(cl);
+        return -1;
+    }
+    return 0;
+}
+
+static void
+_gpt_serve_ready(gpt_io_t *io, int events) {
+    struct serve_client    *cl = (struct serve_client *)io->arg;
+    char                    buf[GPT_MAXBUF];
+    ssize_t                 n;
+
+    if (!cl->dead && (events & GPT_EV_WRITE))
+        _gpt_serve_flush(cl);
+    while (!cl->dead && !cl->eof && (events & GPT_EV_READ)) {
+        if ((n = read(io->fd, buf, sizeof(buf))) == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                cl->dead = 1;
+            break;
+        }
+        if (n == 0) {
+            /* a reply being made is still sent, then the client is closed */
+            cl->eof = 1;
+            gpt_loop_mod(cl->serve->loop, io, cl->out.len > 0 ? GPT_EV_WRITE : 0);
+            break;
+        }
+        if (cl->in.len + n > GPT_SERVE_HEAD + GPT_SERVE_BODY) {
+            cl->dead = 1;
+            break;
+        }
+        gpt_buf_append(&cl->in, buf, n);
+    }
+    /* the client hung up, its request is given up */
+    if (events & GPT_EV_ERROR && cl->out.len == 0)
+        cl->dead = 1;
+    _gpt_serve_next(cl);
+}
+
+static void
+_gpt_serve_accept(gpt_io_t *io, int events) {
+    gpt_serve_t            *s = (gpt_serve_t *)io->arg;
+    struct serve_client    *cl;
+    int                     fd, one = 1;
+
+    while ((fd = accept(io->fd, NULL, NULL)) != -1) {
+        if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1
+            || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1
+            || (cl = (struct serve_client *)calloc(1, sizeof(*cl))) == NULL) {
+            close(fd);
+            continue;
+        }
+        if (s->path == NULL)
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        cl->serve = s;
+        if (gpt_loop_add(s->loop, &cl->io, fd, GPT_EV_READ, _gpt_serve_ready, cl) == -1) {
+            close(fd);
+            free(cl);
+            continue;
+        }
+        cl->next = s->clients;
+        s->clients = cl;
+    }
+}
+
+static int
+_gpt_serve_unix(gpt_serve_t *s, const char *path) {
+    struct sockaddr_un  sun;
+    int                 fd;
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(sun.sun_path, path);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1)
+        return -1;
+    /* a socket left by a server that is gone is taken over */
+    if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == 0) {
+        close(fd);
+        errno = EADDRINUSE;
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+        close(fd);
+        return -1;
+    }
+    s->path = strdup(path);
+    return fd;
+}
+
+/*
+ * Whether sa is on the loopback interface
+ */
+static int
+_gpt_serve_loopback(const struct sockaddr *sa) {
+    const struct in6_addr  *a6;
+
+    if (sa->sa_family == AF_INET)
+        return (ntohl(((const struct sockaddr_in *)sa)->sin_addr.s_addr) >> 24) == 127;
+    if (sa->sa_family != AF_INET6)
+        return 0;
+    a6 = &((const struct sockaddr_in6 *)sa)->sin6_addr;
+    return IN6_IS_ADDR_LOOPBACK(a6) || (IN6_IS_ADDR_V4MAPPED(a6) && a6->s6_addr[12] == 127);
+}
+
+static int
+_gpt_serve_tcp(const char *addr, int any) {
+    struct addrinfo     hints, *ai, *res;
+    char                host[256], *port;
+    int                 fd = -1, one = 1, err;
+
+    /* a bare port is served on the loopback interface only */
+    if (strchr(addr, ':') == NULL) {
+        strcpy(host, "127.0.0.1");
+        port = (char *)addr;
+    } else {
+        snprintf(host, sizeof(host), "%s", addr[0] == '[' ? addr + 1 : addr);
+        port = strrchr(host, ':');
+        *port++ = '\0';
+        if (port > host + 1 && port[-2] == ']')
+            port[-2] = '\0';
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if ((err = getaddrinfo(host[0] != '\0' ? host : NULL, port, &hints, &res)) != 0) {
+        fprintf(stderr, "(cgpt): %s: %s\n", addr, gai_strerror(err));
+        errno = EINVAL;
+        return -1;
+    }
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        /* anyone reaching the socket spends the key of the server */
+        if (!any && !_gpt_serve_loopback(ai->ai_addr)) {
+            fprintf(stderr, "(cgpt): %s is not a loopback address, use --serve-any to allow it\n", addr);
+            errno = EACCES;
+            fd = -1;
+            break;
+        }
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd == -1)
+            continue;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+int
+gpt_serve_init(gpt_serve_t *s, gpt_loop_t *loop, const char *addr, int any) {
+    int fd;
+
+    memset(s, 0, sizeof(*s));
+    s->loop = loop;
+    s->jobs = GPT_BATCH_JOBS;
+    s->io.fd = -1;
+    if (strncmp(addr, "unix:", 5) == 0)
+        fd = _gpt_serve_unix(s, addr + 5);
+    else
+        fd = _gpt_serve_tcp(addr, any);
+    if (fd == -1)
+        return -1;
+    if (listen(fd, GPT_SERVE_BACKLOG) == -1
+        || gpt_loop_add(loop, &s->io, fd, GPT_EV_READ, _gpt_serve_accept, s) == -1) {
+        close(fd);
+        gpt_serve_free(s);
+        return -1;
+    }
+    return 0;
+}
+
+void
+gpt_serve_free(gpt_serve_t *s) {
+    int fd;
+
+    /* nothing waiting is started while the clients go */
+    s->queue = NULL;
+    while (s->clients != NULL)
+        _gpt_serve_close(s->clients);
+    if ((fd = s->io.fd) != -1) {
+        gpt_loop_del(s->loop, &s->io);
+        close(fd);
+    }
+    if (s->path != NULL) {
+        unlink(s->path);
+        free(s->path);
+        s->path = NULL;
+    }
+}
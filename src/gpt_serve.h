@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ * Server mode: cgpt listens on a unix socket or a loopback TCP port and
+ * answers OpenAI-compatible POST /v1/chat/completions requests. They go
+ * out with the key of the server through the connection pool, rate
+ * limit, cache and in-flight table it shares between all its clients,
+ * streamed replies are relayed event by event as they arrive.
+ */
+#ifndef __GPT_SERVE__
+#define __GPT_SERVE__
+
+#include <gpt_config.h>
+
+#define GPT_SERVE_PATH      "/v1/chat/completions"
+#define GPT_SERVE_HEAD      16384       /* bytes a request head may take */
+#define GPT_SERVE_BODY      (8 << 20)   /* bytes a request body may take */
+#define GPT_SERVE_BACKLOG   64
+
+struct serve {
+    gpt_loop_t          *loop;
+    gpt_io_t             io;        /* listening socket */
+    char                *path;      /* unix socket removed at the end, NULL for TCP */
+    gpt_limit_t         *limit;     /* admits the requests, NULL for no rate limit */
+    gpt_vocab_t         *vocab;     /* token counts of the estimates, may be NULL */
+    gpt_flight_t        *flight;    /* requests the start function joins, may be NULL */
+    gpt_cache_t         *cache;     /* replies the start function replays, may be NULL */
+    int                  jobs;      /* requests in flight at once, the rest queue */
+    /*
+     * start a request on loop that the rate limit admitted with
+     * tokens, NULL if it could not be started
+     */
+    gpt_call_t        *(*start)(const gpt_buf_t *req, gpt_sse_t *sse, long tokens,
+                                void (*done)(gpt_call_t *call), void *arg);
+
+    struct serve_client *clients;
+    struct serve_client *queue;     /* waiting for one of the jobs */
+    int                  running;
+    long                 served;    /* requests answered */
+    long                 failed;    /* of them not by the upstream server */
+};
+
+/*
+ * Listen on addr: "unix:/path/to/socket", "host:port" or a
+ * port of the loopback interface. A host other than the loopback
+ * is refused unless any is set, clients use the key of the server.
+ * Return 0 if successful, otherwise return -1
+ */
+int gpt_serve_init(gpt_serve_t *s, gpt_loop_t *loop, const char *addr, int any);
+/*
+ * Close the listening socket and every client, requests
+ * still running are abandoned
+ */
+void gpt_serve_free(gpt_serve_t *s);
+
+#endif
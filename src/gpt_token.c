@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ */
+#include <gpt_config.h>
+
+#define TOKEN_PIECE     64      /* pieces up to this length are merged on the stack */
+
+static uint32_t
+_gpt_token_hash(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+
+    while (len--) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static const struct token_entry *
+_gpt_vocab_find(const gpt_vocab_t *v, const char *s, size_t len) {
+    size_t i = _gpt_token_hash(s, len) & v->mask;
+
+    for (; v->table[i].len != 0; i = (i + 1) & v->mask) {
+        if (v->table[i].len == len && memcmp(v->bytes + v->table[i].off, s, len) == 0)
+            return &v->table[i];
+    }
+    return NULL;
+}
+
+static int
+_gpt_base64(int c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+/*
+ * Decode base64 from s into out, return the decoded length or -1
+ */
+static ssize_t
+_gpt_base64_decode(const char *s, size_t len, char *out) {
+    uint32_t    acc = 0;
+    int         bits = 0, d;
+    ssize_t     n = 0;
+
+    for (size_t i = 0; i < len && s[i] != '='; i++) {
+        if ((d = _gpt_base64((unsigned char)s[i])) == -1)
+            return -1;
+        acc = (acc << 6) | d;
+        if ((bits += 6) >= 8) {
+            bits -= 8;
+            out[n++] = (char)(acc >> bits);
+        }
+    }
+    return n;
+}
+
+gpt_vocab_t *
+gpt_vocab_load(const char *path) {
+    gpt_vocab_t    *v;
+    FILE           *fp;
+    char           *line = NULL, *sp;
+    size_t          cap = 0, lines = 0, i;
+    ssize_t         n, len;
+
+    if ((fp = fopen(path, "r")) == NULL)
+        return NULL;
+    if ((v = (gpt_vocab_t *)calloc(1, sizeof(*v))) == NULL)
+        goto fail;
+
+    /* a decoded token is never longer than its base64 form */
+    fseek(fp, 0, SEEK_END);
+    v->bytes = (char *)malloc(ftell(fp) + 1);
+    rewind(fp);
+    while ((n = getline(&line, &cap, fp)) != -1)
+        lines++;
+    rewind(fp);
+    for (v->mask = 1; v->mask < lines * 2; v->mask <<= 1)
+        ;
+    v->table = (struct token_entry *)calloc(v->mask, sizeof(*v->table));
+    v->mask--;
+    if (v->bytes == NULL || v->table == NULL)
+        goto fail;
+
+    while ((n = getline(&line, &cap, fp)) != -1) {
+        if ((sp = strchr(line, ' ')) == NULL)
+            continue;
+        len = _gpt_base64_decode(line, sp - line, v->bytes + v->size);
+        if (len <= 0)
+            goto fail;
+        for (i = _gpt_token_hash(v->bytes + v->size, len) & v->mask;
+             v->table[i].len != 0; i = (i + 1) & v->mask)
+            ;
+        v->table[i].off = v->size;
+        v->table[i].len = len;
+        v->table[i].rank = strtoul(sp + 1, NULL, 10);
+        v->size += len;
+        v->count++;
+    }
+    free(line);
+    fclose(fp);
+    return v;
+
+fail:
+    free(line);
+    fclose(fp);
+    gpt_vocab_free(v);
+    return NULL;
+}
+
+void
+gpt_vocab_free(gpt_vocab_t *v) {
+    if (v == NULL)
+        return;
+    free(v->bytes);
+    free(v->table);
+    free(v);
+}
+
+static uint32_t
+_gpt_token_rank(const gpt_vocab_t *v, const char *s, size_t len) {
+    const struct token_entry *e = _gpt_vocab_find(v, s, len);
+
+    return e ? e->rank : UINT32_MAX;
+}
+
+/*
+ * Byte pair encode one piece and return its number of tokens: the
+ * adjacent pair whose concatenation has the lowest rank is merged
+ * until no pair is in the vocabulary.
+ */
+static size_t
+_gpt_token_bpe(const gpt_vocab_t *v, const char *s, size_t len) {
+    size_t      sbound[TOKEN_PIECE + 1], *bound = sbound;
+    uint32_t    srank[TOKEN_PIECE], *rank = srank, best;
+    size_t      parts = len, i, at;
+
+    if (len == 1 || _gpt_vocab_find(v, s, len) != NULL)
+        return 1;
+    if (len > TOKEN_PIECE) {
+        bound = (size_t *)malloc((len + 1) * sizeof(*bound));
+        rank = (uint32_t *)malloc(len * sizeof(*rank));
+        if (bound == NULL || rank == NULL) {
+            free(bound == sbound ? NULL : bound);
+            free(rank == srank ? NULL : rank);
+            return (len + 3) / 4;
+        }
+    }
+
+    /* part i is s[bound[i], bound[i+1]), rank[i] is that of parts i and i+1 */
+    for (i = 0; i <= len; i++)
+        bound[i] = i;
+    for (i = 0; i + 1 < parts; i++)
+        rank[i] = _gpt_token_rank(v, s + bound[i], bound[i + 2] - bound[i]);
+
+    while (parts > 1) {
+        best = UINT32_MAX;
+        for (i = 0; i + 1 < parts; i++) {
+            if (rank[i] < best) {
+                best = rank[i];
+                at = i;
+            }
+        }
+        if (best == UINT32_MAX)
+            break;
+        /* drop the boundary between parts at and at+1 */
+        memmove(bound + at + 1, bound + at + 2, (parts - at - 1) * sizeof(*bound));
+        memmove(rank + at + 1, rank + at + 2, (parts - at - 2) * sizeof(*rank));
+        parts--;
+        if (at + 1 < parts)
+            rank[at] = _gpt_token_rank(v, s + bound[at], bound[at + 2] - bound[at]);
+        if (at > 0)
+            rank[at - 1] = _gpt_token_rank(v, s + bound[at - 1], bound[at + 1] - bound[at - 1]);
+    }
+
+    if (bound != sbound) {
+        free(bound);
+        free(rank);
+    }
+    return parts;
+}
+
+/*
+ * Non-ASCII bytes count as letters, close enough to \p{L}
+ */
+static int
+_gpt_token_letter(unsigned char c) {
+    return isalpha(c) || c >= 0x80;
+}
+
+static int
+_gpt_token_space(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static int
+_gpt_token_other(unsigned char c) {
+    return !_gpt_token_space(c) && !_gpt_token_letter(c) && !isdigit(c);
+}
+
+/*
+ * Length of the piece at the start of s, following the cl100k_base
+ * split: contractions, words with one leading non-letter, runs of up
+ * to 3 digits, punctuation with one leading space and trailing newlines,
+ * and whitespace (the last blank before a word goes with that word).
+ */
+static size_t
+_gpt_token_piece(const char *s, size_t len) {
+    const unsigned char *p = (const unsigned char *)s;
+    size_t               i = 0, nl;
+
+    if (p[0] == '\'' && len > 1) {
+        int c1 = tolower(p[1]), c2 = len > 2 ? tolower(p[2]) : 0;
+
+        if ((c1 == 'r' && c2 == 'e') || (c1 == 'v' && c2 == 'e') || (c1 == 'l' && c2 == 'l'))
+            return 3;
+        if (c1 == 's' || c1 == 't' || c1 == 'm' || c1 == 'd')
+            return 2;
+    }
+    if (_gpt_token_letter(p[0])
+        || (len > 1 && p[0] != '\r' && p[0] != '\n' && !isdigit(p[0])
+            && !_gpt_token_letter(p[0]) && _gpt_token_letter(p[1]))) {
+        for (i = 1; i < len && _gpt_token_letter(p[i]); i++)
+            ;
+        return i;
+    }
+    if (isdigit(p[0])) {
+        for (i = 1; i < len && i < 3 && isdigit(p[i]); i++)
+            ;
+        return i;
+    }
+    if (_gpt_token_other(p[0]) || (p[0] == ' ' && len > 1 && _gpt_token_other(p[1]))) {
+        for (i = 1; i < len && _gpt_token_other(p[i]); i++)
+            ;
+        while (i < len && (p[i] == '\r' || p[i] == '\n'))
+            i++;
+        return i;
+    }
+
+    /* whitespace */
+    for (i = 1, nl = p[0] == '\n' || p[0] == '\r' ? 1 : 0; i < len && _gpt_token_space(p[i]); i++) {
+        if (p[i] == '\n' || p[i] == '\r')
+            nl = i + 1;
+    }
+    if (nl > 0)
+        return nl;
+    if (i < len && i > 1)
+        return i - 1;
+    return i;
+}
+
+size_t
+gpt_token_count(const gpt_vocab_t *v, const char *s, size_t len) {
+    size_t  tokens = 0, n;
+
+    while (len > 0) {
+        n = _gpt_token_piece(s, len);
+        /* without the ranks a piece is taken as one token per 4 bytes */
+        tokens += v ? _gpt_token_bpe(v, s, n) : (n + 3) / 4;
+        s += n;
+        len -= n;
+    }
+    return tokens;
+}
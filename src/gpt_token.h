@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ * Token counting for the context window. With a vocabulary (the
+ * tiktoken cl100k_base ranks file of gpt-3.5-turbo) text is split
+ * and byte pair encoded like the server does, without one the count
+ * is estimated from the same split.
+ */
+#ifndef __GPT_TOKEN__
+#define __GPT_TOKEN__
+
+#include <gpt_config.h>
+
+#define GPT_CONTEXT         4096    /* context window of GPT_MODEL in tokens */
+#define GPT_CONTEXT_REPLY   512     /* tokens of the window kept for the reply */
+#define GPT_TOKEN_MESSAGE   3       /* tokens every message costs besides its text */
+#define GPT_TOKEN_PRIMING   3       /* tokens priming the reply */
+
+struct token_entry {
+    uint32_t    off;        /* bytes of the token in vocab->bytes */
+    uint32_t    len;
+    uint32_t    rank;
+};
+
+struct vocab {
+    char               *bytes;
+    size_t              size;
+    struct token_entry *table;  /* open addressing, len 0 is empty */
+    size_t              mask;
+    size_t              count;
+};
+
+/*
+ * Load a ranks file, one "<base64 token> <rank>" per line
+ */
+gpt_vocab_t *gpt_vocab_load(const char *path);
+void gpt_vocab_free(gpt_vocab_t *v);
+/*
+ * Number of tokens of s, estimated when v is NULL
+ */
+size_t gpt_token_count(const gpt_vocab_t *v, const char *s, size_t len);
+
+#endif
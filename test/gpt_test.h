@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ * Checks shared by the unit tests, a failed check is reported
+ * and the test goes on, main returns the number of failures.
+ */
+#ifndef __GPT_TEST__
+#define __GPT_TEST__
+
+#include <gpt_config.h>
+
+static int gpt_test_failed;
+
+#define GPT_CHECK(cond) do {                                            \
+    if (!(cond)) {                                                      \
+        printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);               \
+        gpt_test_failed++;                                              \
+    }                                                                   \
+} while (0)
+
+#define GPT_CHECK_STR(s, len, want) \
+    GPT_CHECK((len) == strlen(want) && memcmp((s), (want), (len)) == 0)
+
+#endif
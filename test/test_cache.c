@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ * The response cache on disk: reopening, keys per endpoint, recovery
+ * of records cut short or damaged by a crash, checksums and compaction
+ * under the size cap.
+ */
+#include "gpt_test.h"
+
+static char dir[] = "/tmp/cgpt-cache-XXXXXX";
+static const char *target = "https://api.openai.com:443/v1/chat/completions";
+
+static void
+_test_path(char *path, size_t size, const char *name) {
+    snprintf(path, size, "%s/%s", dir, name);
+}
+
+static off_t
+_test_size(void) {
+    char        path[PATH_MAX];
+    struct stat st;
+
+    _test_path(path, sizeof(path), "data");
+    return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+static void
+_test_truncate(off_t size) {
+    char    path[PATH_MAX];
+
+    _test_path(path, sizeof(path), "data");
+    GPT_CHECK(truncate(path, size) == 0);
+}
+
+static void
+_test_unlink(const char *name) {
+    char    path[PATH_MAX];
+
+    _test_path(path, sizeof(path), name);
+    unlink(path);
+}
+
+static int
+_test_put(gpt_cache_t *c, const char *body, const char *reply) {
+    uint8_t key[GPT_CACHE_KEY];
+
+    gpt_cache_key(body, strlen(body), key);
+    return gpt_cache_put(c, key, reply, strlen(reply));
+}
+
+/*
+ * Whether body is answered with reply
+ */
+static int
+_test_get(gpt_cache_t *c, const char *body, const char *reply) {
+    uint8_t     key[GPT_CACHE_KEY];
+    gpt_buf_t   out;
+    int         rc;
+
+    memset(&out, 0, sizeof(out));
+    gpt_cache_key(body, strlen(body), key);
+    rc = gpt_cache_get(c, key, &out) == 0;
+    if (rc && (out.len != strlen(reply) || memcmp(out.data, reply, out.len) != 0))
+        rc = -1;
+    gpt_buf_free(&out);
+    return rc;
+}
+
+static void
+_test_reopen(void) {
+    gpt_cache_t    *c;
+
+    GPT_CHECK((c = gpt_cache_open(dir, 1 << 20, target)) != NULL);
+    GPT_CHECK(_test_get(c, "a", "alpha") == 0);
+    GPT_CHECK(c->misses == 1);
+    GPT_CHECK(_test_put(c, "a", "alpha") == 0);
+    GPT_CHECK(_test_put(c, "b", "bravo, a longer one") == 0);
+    GPT_CHECK(_test_get(c, "a", "alpha") == 1);
+    GPT_CHECK(gpt_cache_has(c, "b", 1) == 1);
+    GPT_CHECK(gpt_cache_has(c, "c", 1) == 0);
+    GPT_CHECK(c->hits == 1);
+    gpt_cache_close(c);
+
+    GPT_CHECK((c = gpt_cache_open(dir, 1 << 20, target)) != NULL);
+    GPT_CHECK(_test_get(c, "a", "alpha") == 1);
+    GPT_CHECK(_test_get(c, "b", "bravo, a longer one") == 1);
+    gpt_cache_close(c);
+
+    /* the same bodies sent to another endpoint are not answered */
+    GPT_CHECK((c = gpt_cache_open(dir, 1 << 20, "http://localhost:8080/v1/chat/completions")) != NULL);
+    GPT_CHECK(_test_get(c, "a", "alpha") == 0);
+    GPT_CHECK(gpt_cache_has(c, "b", 1) == 0);
+    gpt_cache_close(c);
+}
+
+/*
+ * A crash may leave the last record short, in its payload or only in
+ * its padding, with or without the index covering it. The reply of c
+ * takes 45 bytes with its header, 3 bytes of padding follow.
+ */
+static void
+_test_truncated(void) {
+    gpt_cache_t    *c;
+    off_t           size, cut[] = {6, 2};
+    size_t          i;
+
+    for (i = 0; i < sizeof(cut) / sizeof(cut[0]); i++) {
+        GPT_CHECK((c = gpt_cache_open(dir, 1 << 20, target)) != NULL);
+        size = _test_size();
+        GPT_CHECK(_test_put(c, "c", "charlie, 3pad") == 0);
+        gpt_cache_close(c);
+        _test_truncate(_test_size() - cut[i]);
+        if (i == 0)
+            _test_unlink("index");
+
+        GPT_CHECK((c = gpt_cache_open(dir, 1 << 20, target)) != NULL);
+        GPT_CHECK(_test_size() == size);
+        GPT_CHECK(_test_get(c, "a", "alpha") == 1);
+        GPT_CHECK(_test_get(c, "b", "bravo, a longer one") == 1);
+        GPT_CHECK(_test_get(c, "c", "charlie, 3pad") == 0);
+        /* appends go on where the last whole record ends */
+        GPT_CHECK(_test_put(c, "d", "delta") == 0);
+        gpt_cache_close(c);
+
+        _test_unlink("index");
+        GPT_CHECK((c = gpt_cache_open(dir, 1 << 20, target)) != NULL);
+        GPT_CHECK(_test_get(c, "d", "delta") == 1);
+        gpt_cache_close(c);
+        _test_truncate(size);
+    }
+}
+
+/*
+ * A damaged reply fails its checksum, recovery stops there
+ */
+static void
+_test_crc(void) {
+    gpt_cache_t    *c;
+    char            path[PATH_MAX];
+    off_t           size;
+    int             fd;
+
+    GPT_CHECK((c = gpt_cache_open(dir, 1 << 20, target)) != NULL);
+    size = _test_size();
+    GPT_CHECK(_test_put(c, "e", "echo") == 0);
+    GPT_CHECK(_test_put(c, "f", "foxtrot") == 0);
+    gpt_cache_close(c);
+
+    /* the reply of e follows its 32 byte header */
+    _test_path(path, sizeof(path), "data");
+    GPT_CHECK((fd = open(path, O_WRONLY)) != -1);
+    GPT_CHECK(pwrite(fd, "E", 1, size + 32) == 1);
+    close(fd);
+
+    GPT_CHECK((c = gpt_cache_open(dir, 1 << 20, target)) != NULL);
+    GPT_CHECK(_test_get(c, "e", "echo") == 0);
+    GPT_CHECK(_test_get(c, "f", "foxtrot") == 1);
+    gpt_cache_close(c);
+
+    _test_unlink("index");
+    GPT_CHECK((c = gpt_cache_open(dir, 1 << 20, target)) != NULL);
+    GPT_CHECK(_test_size() == size);
+    GPT_CHECK(_test_get(c, "a", "alpha") == 1);
+    GPT_CHECK(_test_get(c, "e", "echo") == 0);
+    GPT_CHECK(_test_get(c, "f", "foxtrot") == 0);
+    gpt_cache_close(c);
+}
+
+/*
+ * Past the cap the data is rewritten with what fits in half of it,
+ * whatever is kept still answers after a reopen
+ */
+static void
+_test_compact(void) {
+    gpt_cache_t    *c;
+    char            body[16], reply[200], big[2048 - 16 - 32 + 2];
+    int             i, kept = 0;
+
+    memset(reply, 'r', sizeof(reply) - 1);
+    reply[sizeof(reply) - 1] = '\0';
+    GPT_CHECK((c = gpt_cache_open(dir, 4096, target)) != NULL);
+    /* more than compaction keeps is not stored at all */
+    memset(big, 'b', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    GPT_CHECK(_test_put(c, "big", big) == -1);
+    for (i = 0; i < 64; i++) {
+        snprintf(body, sizeof(body), "body %d", i);
+        reply[0] = 'A' + i % 26;
+        GPT_CHECK(_test_put(c, body, reply) == 0);
+        GPT_CHECK(_test_size() <= 4096);
+    }
+    gpt_cache_close(c);
+
+    GPT_CHECK((c = gpt_cache_open(dir, 4096, target)) != NULL);
+    for (i = 0; i < 64; i++) {
+        snprintf(body, sizeof(body), "body %d", i);
+        reply[0] = 'A' + i % 26;
+        GPT_CHECK(_test_get(c, body, reply) != -1);
+        kept += gpt_cache_has(c, body, strlen(body));
+    }
+    GPT_CHECK(kept > 0 && kept < 64);
+    /* the largest record compaction keeps, the newest one is kept first */
+    big[sizeof(big) - 2] = '\0';
+    GPT_CHECK(_test_put(c, "big", big) == 0);
+    GPT_CHECK(gpt_cache_has(c, "big", 3) == 1);
+    GPT_CHECK(c->hits == kept);
+    gpt_cache_close(c);
+}
+
+int
+main(void) {
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    _test_reopen();
+    _test_truncated();
+    _test_crc();
+    _test_compact();
+
+    _test_unlink("data");
+    _test_unlink("index");
+    _test_unlink("lock");
+    rmdir(dir);
+    return gpt_test_failed;
+}
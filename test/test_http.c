@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ * The incremental HTTP response parser, its chunked decoder and the
+ * event stream parser, fed the same input split at every offset.
+ */
+#include "gpt_test.h"
+
+/*
+ * Feed s in two pieces cut at split, return what the last feed returned
+ */
+static int
+_test_feed(gpt_response_t *rsp, const char *s, size_t split) {
+    size_t  len = strlen(s);
+    int     rc;
+
+    gpt_http_response_init(rsp);
+    if ((rc = gpt_http_response_feed(rsp, s, split)) != 0)
+        return rc;
+    return gpt_http_response_feed(rsp, s + split, len - split);
+}
+
+static void
+_test_length(void) {
+    const char     *s = "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: application/json\r\n"
+                        "content-length: 11\r\n"
+                        "\r\n"
+                        "{\"a\":\"bc\"}\n";
+    gpt_response_t  rsp;
+    size_t          i;
+
+    for (i = 0; i <= strlen(s); i++) {
+        GPT_CHECK(_test_feed(&rsp, s, i) == 1);
+        GPT_CHECK(rsp.status == 200);
+        GPT_CHECK(rsp.keepalive == 1);
+        GPT_CHECK(rsp.length == 11);
+        GPT_CHECK_STR(rsp.body.data, rsp.body.len, "{\"a\":\"bc\"}\n");
+        gpt_http_response_free(&rsp);
+    }
+
+    /* one byte at a time */
+    gpt_http_response_init(&rsp);
+    for (i = 0; i < strlen(s) - 1; i++)
+        GPT_CHECK(gpt_http_response_feed(&rsp, s + i, 1) == 0);
+    GPT_CHECK(gpt_http_response_feed(&rsp, s + i, 1) == 1);
+    GPT_CHECK_STR(rsp.body.data, rsp.body.len, "{\"a\":\"bc\"}\n");
+    gpt_http_response_free(&rsp);
+}
+
+static void
+_test_chunked(void) {
+    const char     *s = "HTTP/1.1 100 Continue\r\n"
+                        "\r\n"
+                        "HTTP/1.1 200 OK\r\n"
+                        "Transfer-Encoding: gzip, chunked\r\n"
+                        "\r\n"
+                        "4\r\nWiki\r\n"
+                        "5;name=value\r\npedia\r\n"
+                        "E\r\n in\r\n\r\nchunks.\r\n"
+                        "0\r\n"
+                        "X-Trailer: yes\r\n"
+                        "\r\n";
+    gpt_response_t  rsp;
+    size_t          i;
+
+    for (i = 0; i <= strlen(s); i++) {
+        GPT_CHECK(_test_feed(&rsp, s, i) == 1);
+        GPT_CHECK(rsp.status == 200);
+        GPT_CHECK(rsp.chunked == 1);
+        GPT_CHECK_STR(rsp.body.data, rsp.body.len, "Wikipedia in\r\n\r\nchunks.");
+        gpt_http_response_free(&rsp);
+    }
+
+    /* what follows a response makes the connection unfit for reuse */
+    gpt_http_response_init(&rsp);
+    GPT_CHECK(gpt_http_response_feed(&rsp, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                     "1\r\na\r\n0\r\n\r\nHTTP", 62) == 1);
+    GPT_CHECK(rsp.keepalive == 0);
+    gpt_http_response_free(&rsp);
+
+    gpt_http_response_init(&rsp);
+    GPT_CHECK(gpt_http_response_feed(&rsp, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                     "zz\r\n", 51) == -1);
+    gpt_http_response_free(&rsp);
+}
+
+static void
+_test_eof(void) {
+    const char     *s = "HTTP/1.0 503 Service Unavailable\r\n"
+                        "Retry-After: 2\r\n"
+                        "retry-after-ms: 1500\r\n"
+                        "\r\n"
+                        "busy";
+    gpt_response_t  rsp;
+    size_t          i;
+
+    for (i = 0; i <= strlen(s); i++) {
+        GPT_CHECK(_test_feed(&rsp, s, i) == 0);
+        GPT_CHECK(gpt_http_response_eof(&rsp) == 1);
+        GPT_CHECK(rsp.status == 503);
+        GPT_CHECK(rsp.keepalive == 0);
+        GPT_CHECK(rsp.retry_after == 1500);
+        GPT_CHECK_STR(rsp.body.data, rsp.body.len, "busy");
+        gpt_http_response_free(&rsp);
+    }
+
+    /* a body cut short by the peer is not a response */
+    gpt_http_response_init(&rsp);
+    GPT_CHECK(gpt_http_response_feed(&rsp, "HTTP/1.1 200 OK\r\nContent-Length: 9\r\n\r\nabc", 41) == 0);
+    GPT_CHECK(gpt_http_response_eof(&rsp) == -1);
+    gpt_http_response_free(&rsp);
+
+    gpt_http_response_init(&rsp);
+    GPT_CHECK(gpt_http_response_feed(&rsp, "SSH-2.0-OpenSSH\r\n", 17) == -1);
+    gpt_http_response_free(&rsp);
+}
+
+struct events {
+    gpt_buf_t   all;
+};
+
+static void
+_test_event(void *arg, const char *data, size_t len) {
+    struct events *e = (struct events *)arg;
+
+    gpt_buf_append(&e->all, data, len);
+    gpt_buf_append(&e->all, "|", 1);
+}
+
+static void
+_test_sse(void) {
+    const char     *s = ": keep-alive\n"
+                        "event: message\r\n"
+                        "data: {\"a\":\r\n"
+                        "data:1}\r\n"
+                        "\r\n"
+                        "id: 7\n"
+                        "\n"
+                        "data: [DONE]\n"
+                        "\n";
+    struct events   e;
+    gpt_sse_t       sse;
+    size_t          i, len = strlen(s);
+
+    memset(&e, 0, sizeof(e));
+    for (i = 0; i <= len; i++) {
+        memset(&sse, 0, sizeof(sse));
+        sse.on_event = _test_event;
+        sse.arg = &e;
+        gpt_buf_reset(&e.all);
+        GPT_CHECK(gpt_sse_feed(&sse, s, i) == 0);
+        GPT_CHECK(gpt_sse_feed(&sse, s + i, len - i) == 0);
+        GPT_CHECK(sse.events == 2);
+        GPT_CHECK_STR(e.all.data, e.all.len, "{\"a\":\n1}|[DONE]|");
+        gpt_sse_free(&sse);
+    }
+    gpt_buf_free(&e.all);
+}
+
+int
+main(void) {
+    _test_length();
+    _test_chunked();
+    _test_eof();
+    _test_sse();
+    return gpt_test_failed;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ * Replies decoded in place by gpt_json_view: string escapes, \u
+ * escapes with surrogate pairs, error objects and malformed input.
+ */
+#include "gpt_test.h"
+
+/*
+ * Decode a copy of js, the view owns it afterwards
+ */
+static int
+_test_view(const char *js, gpt_view_t *v) {
+    return gpt_json_view(strdup(js), strlen(js), v);
+}
+
+static void
+_test_completion(void) {
+    gpt_view_t  v;
+
+    GPT_CHECK(_test_view(
+        " {\"id\":\"chatcmpl-1\",\"object\":\"chat.completion\",\"created\":1681223664,"
+        "\"model\":\"gpt-3.5-turbo-0301\",\"extra\":{\"a\":[1,-2.5e3,true,null,\"]\"]},"
+        "\"usage\":{\"prompt_tokens\":13,\"completion_tokens\":152,\"total_tokens\":165},"
+        "\"choices\":[{\"message\":{\"role\":\"assistant\","
+        "\"content\":\"q\\\"b\\\\s\\/ \\b\\f\\n\\r\\t \\u0041\\u00e9\\u20AC\\ud83d\\ude00\"},"
+        "\"finish_reason\":\"stop\",\"index\":0},"
+        "{\"message\":{\"role\":\"assistant\",\"content\":\"\"},\"finish_reason\":null,\"index\":1}]}\n",
+        &v) == 0);
+    GPT_CHECK(v.error == 0);
+    GPT_CHECK_STR(v.id.s, v.id.len, "chatcmpl-1");
+    GPT_CHECK_STR(v.object.s, v.object.len, "chat.completion");
+    GPT_CHECK_STR(v.model.s, v.model.len, "gpt-3.5-turbo-0301");
+    GPT_CHECK(v.created == 1681223664);
+    GPT_CHECK(v.usage.prompt_tokens == 13);
+    GPT_CHECK(v.usage.completion_tokens == 152);
+    GPT_CHECK(v.usage.total_tokens == 165);
+    GPT_CHECK(v.choices_num == 2);
+    GPT_CHECK_STR(v.choices[0].role.s, v.choices[0].role.len, "assistant");
+    GPT_CHECK_STR(v.choices[0].content.s, v.choices[0].content.len,
+                  "q\"b\\s/ \b\f\n\r\t A\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80");
+    GPT_CHECK_STR(v.choices[0].finish_reason.s, v.choices[0].finish_reason.len, "stop");
+    GPT_CHECK(v.choices[1].index == 1);
+    GPT_CHECK(v.choices[1].content.len == 0);
+    GPT_CHECK(v.choices[1].finish_reason.len == 0);
+    gpt_json_view_free(&v);
+}
+
+static void
+_test_error(void) {
+    gpt_view_t  v;
+
+    GPT_CHECK(_test_view(
+        "{\"error\":{\"message\":\"Rate limit reached \\u2014 slow down\","
+        "\"type\":\"requests\",\"param\":null,\"code\":\"rate_limit_exceeded\"}}", &v) == 1);
+    GPT_CHECK(v.error == 1);
+    GPT_CHECK_STR(v.message.s, v.message.len, "Rate limit reached \xE2\x80\x94 slow down");
+    GPT_CHECK_STR(v.type.s, v.type.len, "requests");
+    GPT_CHECK(v.param.len == 0);
+    GPT_CHECK_STR(v.code.s, v.code.len, "rate_limit_exceeded");
+    gpt_json_view_free(&v);
+}
+
+static void
+_test_malformed(void) {
+    static const char *bad[] = {
+        "{\"choices\":[{\"message\":{\"content\":\"\\ud83d\"}}]}",          /* lone high surrogate */
+        "{\"choices\":[{\"message\":{\"content\":\"\\ud83d\\u0041\"}}]}",   /* high, then not a low one */
+        "{\"choices\":[{\"message\":{\"content\":\"\\ud83dx\"}}]}",
+        "{\"choices\":[{\"message\":{\"content\":\"\\u00g1\"}}]}",
+        "{\"choices\":[{\"message\":{\"content\":\"\\x41\"}}]}",
+        "{\"choices\":[{\"message\":{\"content\":\"open",
+        "{\"id\":\"x\"",
+        "[]",
+    };
+    gpt_view_t  v;
+    size_t      i;
+
+    for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        GPT_CHECK(_test_view(bad[i], &v) == -1);
+        gpt_json_view_free(&v);
+    }
+}
+
+/*
+ * What gpt_json_escape writes decodes back to the same bytes
+ */
+static void
+_test_escape(void) {
+    const char  text[] = "say \"hi\"\\ \x01\x1f\n\t\r\xE4\xBD\xA0\xF0\x9F\x98\x80 </end>";
+    gpt_buf_t   b;
+    gpt_view_t  v;
+
+    memset(&b, 0, sizeof(b));
+    gpt_buf_puts(&b, "{\"choices\":[{\"message\":{\"content\":");
+    GPT_CHECK(gpt_json_escape(&b, text, sizeof(text) - 1) == 0);
+    gpt_buf_puts(&b, "}}]}");
+    GPT_CHECK(memchr(b.data, '\n', b.len) == NULL);
+    GPT_CHECK(gpt_json_view(b.data, b.len, &v) == 0);
+    GPT_CHECK(v.choices_num == 1);
+    GPT_CHECK(v.choices[0].content.len == sizeof(text) - 1);
+    GPT_CHECK(memcmp(v.choices[0].content.s, text, sizeof(text) - 1) == 0);
+    gpt_json_view_free(&v);
+}
+
+int
+main(void) {
+    _test_completion();
+    _test_error();
+    _test_malformed();
+    _test_escape();
+    return gpt_test_failed;
+}
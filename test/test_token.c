@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2023-2023 HXU-YanRuiBing <772166784@qq.com> All rights reserved.
+ * Token counts with a small ranks file: the split into pieces and the
+ * byte pair merges, which take the lowest ranked pair first.
+ */
+#include "gpt_test.h"
+
+static const char *ranks =
+    "YWI= 1\n"          /* "ab" */
+    "YmM= 0\n"          /* "bc" */
+    "Y2Q= 2\n"          /* "cd" */
+    "YWE= 3\n"          /* "aa" */
+    "YWFhYQ== 4\n"      /* "aaaa" */
+    "IGhlbGxv 10\n"     /* " hello" */
+    "IHdvcmxk 11\n"     /* " world" */
+    "MTIz 20\n"         /* "123" */
+    "NDU= 21\n"         /* "45" */
+    "ZG9u 22\n"         /* "don" */
+    "J3Q= 23\n"         /* "'t" */
+    "Cgo= 24\n";        /* "\n\n" */
+
+static size_t
+_test_count(const gpt_vocab_t *v, const char *s) {
+    return gpt_token_count(v, s, strlen(s));
+}
+
+static void
+_test_merge(const gpt_vocab_t *v) {
+    char    long_a[131];
+
+    GPT_CHECK(_test_count(v, "bc") == 1);
+    GPT_CHECK(_test_count(v, "x") == 1);
+    GPT_CHECK(_test_count(v, "xyz") == 3);
+    /* bc goes first and leaves a|bc|d, merging ab first would give ab|cd */
+    GPT_CHECK(_test_count(v, "abcd") == 3);
+    GPT_CHECK(_test_count(v, "abc") == 2);
+    GPT_CHECK(_test_count(v, "aaaa") == 1);
+    /* aa|a|a|a, aa|aa|a, then aaaa|a */
+    GPT_CHECK(_test_count(v, "aaaaa") == 2);
+    /* longer than a piece merged on the stack: 65 aa, then 32 aaaa and one aa */
+    memset(long_a, 'a', 130);
+    long_a[130] = '\0';
+    GPT_CHECK(_test_count(v, long_a) == 33);
+}
+
+static void
+_test_split(const gpt_vocab_t *v) {
+    /* " hello", " world", "123", "45", "don", "'t", "\n\n" */
+    GPT_CHECK(_test_count(v, " hello world12345don't\n\n") == 7);
+    GPT_CHECK(_test_count(v, "") == 0);
+    /* without ranks every piece is a token per 4 bytes */
+    GPT_CHECK(_test_count(NULL, "hello world") == 4);
+    GPT_CHECK(_test_count(NULL, "12345") == 2);
+}
+
+int
+main(void) {
+    char        path[] = "/tmp/cgpt-ranks-XXXXXX";
+    gpt_vocab_t *v;
+    int         fd;
+
+    if ((fd = mkstemp(path)) == -1 || write(fd, ranks, strlen(ranks)) != (ssize_t)strlen(ranks)) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    v = gpt_vocab_load(path);
+    unlink(path);
+    GPT_CHECK(v != NULL);
+    if (v == NULL)
+        return gpt_test_failed;
+    GPT_CHECK(v->count == 12);
+
+    _test_merge(v);
+    _test_split(v);
+    gpt_vocab_free(v);
+    GPT_CHECK(gpt_vocab_load("/nonexistent/ranks") == NULL);
+    return gpt_test_failed;
+}